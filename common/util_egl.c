@@ -258,6 +258,35 @@ int egl_terminate()
 	return 0;
 }
 
+/* bind the context to the calling thread */
+int egl_make_current()
+{
+	EGLBoolean ret;
+
+	ret = eglMakeCurrent(s_dpy, s_sfc, s_sfc, s_ctx);
+	if (ret != EGL_TRUE) {
+		ELOG("%s\n", __FUNCTION__);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* release the context so that another thread can make it current */
+int egl_release_current()
+{
+	EGLBoolean ret;
+
+	ret = eglMakeCurrent(s_dpy, EGL_NO_SURFACE, EGL_NO_SURFACE,
+			     EGL_NO_CONTEXT);
+	if (ret != EGL_TRUE) {
+		ELOG("%s\n", __FUNCTION__);
+		return -1;
+	}
+
+	return 0;
+}
+
 int egl_swap(bool vsync)
 {
 	EGLBoolean ret;
@@ -272,6 +301,68 @@ int egl_swap(bool vsync)
 	return 0;
 }
 
+int egl_swap_buffers()
+{
+	EGLBoolean ret;
+
+	ret = eglSwapBuffers(s_dpy, s_sfc);
+	if (ret != EGL_TRUE) {
+		ELOG("%s\n", __FUNCTION__);
+		return -1;
+	}
+
+	return 0;
+}
+
+int egl_present(bool vsync)
+{
+	return winsys_swap(vsync);
+}
+
+unsigned int egl_get_refresh_mhz()
+{
+	return winsys_get_refresh_mhz();
+}
+
+/* fd signaling display events such as page flip completion, or -1 */
+int egl_get_event_fd()
+{
+	return winsys_get_event_fd();
+}
+
+int egl_dispatch_events()
+{
+	return winsys_dispatch_events();
+}
+
+bool egl_flip_pending()
+{
+	return winsys_flip_pending();
+}
+
+/* show a client buffer without composition, -1 when it cannot be */
+int egl_scanout(const winsys_dmabuf *buf, bool vsync)
+{
+	return winsys_scanout(buf, vsync);
+}
+
+int egl_get_overlay_num()
+{
+	return winsys_get_overlay_num();
+}
+
+/* layers shown on top of the next presented frame, see winsys_set_overlays() */
+int egl_set_overlays(const winsys_layer *layers, int num)
+{
+	return winsys_set_overlays(layers, num);
+}
+
+/* the client buffer behind the id is destroyed, see winsys_dmabuf */
+void egl_forget_dmabuf(uint64_t id)
+{
+	winsys_forget_dmabuf(id);
+}
+
 int egl_set_swap_interval(bool vsync)
 {
 	EGLBoolean ret;
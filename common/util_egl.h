@@ -27,13 +27,26 @@ extern "C" {
 #include <EGL/eglext.h>
 #include "util_log.h"
 #include "util_extension.h"
+#include "winsys.h"
 #include <stdbool.h>
 
 int egl_init_with_platform_window_surface(int gles_version, int depth_size,
 					  int stencil_size, int sample_num,
 					  int *win_w, int *win_h, bool windowed);
 int egl_terminate();
+int egl_make_current();
+int egl_release_current();
 int egl_swap(bool vsync);
+int egl_swap_buffers();
+int egl_present(bool vsync);
+unsigned int egl_get_refresh_mhz();
+int egl_get_event_fd();
+int egl_dispatch_events();
+bool egl_flip_pending();
+int egl_scanout(const winsys_dmabuf *buf, bool vsync);
+int egl_get_overlay_num();
+int egl_set_overlays(const winsys_layer *layers, int num);
+void egl_forget_dmabuf(uint64_t id);
 int egl_set_swap_interval(bool vsync);
 
 int egl_get_current_surface_dimension(int *width, int *height);
@@ -49,6 +62,8 @@ void egl_set_key_func(void (*func)(int key, int state));
 void egl_set_touch_down_func(void (*func)(int id, int x, int y));
 void egl_set_touch_up_func(void (*func)(int id));
 void egl_set_touch_motion_func(void (*func)(int id, int x, int y));
+void egl_set_page_flip_func(void (*func)(unsigned int frame, unsigned int sec,
+					 unsigned int usec, bool vsync));
 
 EGLDisplay egl_get_display();
 EGLContext egl_get_context();
@@ -74,9 +74,67 @@ void main (void)                                      \n\
     gl_FragColor *= u_Color;                          \n\
 }                                                     \n";
 
+/* ------------------------------------------------------ *
+ *  shader for Texture with channel swizzle
+ * ------------------------------------------------------ */
+static char fs_tex_swizzle[] = "                      \n\
+precision mediump float;                              \n\
+varying     vec2      v_TexCoord;                     \n\
+uniform     sampler2D u_sampler;                      \n\
+uniform     vec4      u_Color;                        \n\
+uniform     mat4      u_Swizzle;                      \n\
+uniform     vec4      u_SwizzleConst;                 \n\
+                                                      \n\
+void main (void)                                      \n\
+{                                                     \n\
+    gl_FragColor = u_Swizzle * texture2D (u_sampler, v_TexCoord); \n\
+    gl_FragColor += u_SwizzleConst;                   \n\
+    gl_FragColor *= u_Color;                          \n\
+}                                                     \n";
+
+/* ------------------------------------------------------ *
+ *  shaders for YUV Textures, see draw_2d_texture_yuv()
+ * ------------------------------------------------------ */
+#define FS_YUV_HEAD "                                  \n\
+precision mediump float;                              \n\
+varying     vec2      v_TexCoord;                     \n\
+uniform     sampler2D u_sampler;                      \n\
+uniform     sampler2D u_sampler1;                     \n\
+uniform     sampler2D u_sampler2;                     \n\
+uniform     vec4      u_Color;                        \n\
+uniform     mat3      u_YuvMatrix;                    \n\
+uniform     vec3      u_YuvOffset;                    \n\
+                                                      \n\
+void main (void)                                      \n\
+{                                                     \n\
+    vec3 yuv;                                         \n"
+
+#define FS_YUV_TAIL "                                  \n\
+    yuv -= u_YuvOffset;                               \n\
+    gl_FragColor = vec4 (u_YuvMatrix * yuv, 1.0);     \n\
+    gl_FragColor *= u_Color;                          \n\
+}                                                     \n"
+
+static char fs_yuv_y_u_v[] = FS_YUV_HEAD "            \n\
+    yuv.x = texture2D (u_sampler, v_TexCoord).r;      \n\
+    yuv.y = texture2D (u_sampler1, v_TexCoord).r;     \n\
+    yuv.z = texture2D (u_sampler2, v_TexCoord).r;     \n" FS_YUV_TAIL;
+
+static char fs_yuv_y_uv[] = FS_YUV_HEAD "             \n\
+    yuv.x = texture2D (u_sampler, v_TexCoord).r;      \n\
+    yuv.yz = texture2D (u_sampler1, v_TexCoord).ra;   \n" FS_YUV_TAIL;
+
+static char fs_yuv_y_xuxv[] = FS_YUV_HEAD "           \n\
+    yuv.x = texture2D (u_sampler, v_TexCoord).r;      \n\
+    yuv.yz = texture2D (u_sampler1, v_TexCoord).ga;   \n" FS_YUV_TAIL;
+
 enum shader_type {
 	SHADER_TYPE_FILL = 0, // 0
 	SHADER_TYPE_TEX, // 1
+	SHADER_TYPE_TEX_SWIZZLE, // 2
+	SHADER_TYPE_YUV_Y_U_V, // 3
+	SHADER_TYPE_YUV_Y_UV, // 4
+	SHADER_TYPE_YUV_Y_XUXV, // 5
 
 	SHADER_TYPE_MAX
 };
@@ -87,12 +145,26 @@ static char *s_shader[SHADER_NUM * 2] = {
 	fs_fill,
 	vs_tex,
 	fs_tex,
+	vs_tex,
+	fs_tex_swizzle,
+	vs_tex,
+	fs_yuv_y_u_v,
+	vs_tex,
+	fs_yuv_y_uv,
+	vs_tex,
+	fs_yuv_y_xuxv,
 };
 
 static shader_obj_t s_sobj[SHADER_NUM];
 static int s_loc_mtx[SHADER_NUM];
 static int s_loc_color[SHADER_NUM];
 static int s_loc_texdim[SHADER_NUM];
+static int s_loc_swizzle[SHADER_NUM];
+static int s_loc_swizzle_const[SHADER_NUM];
+static int s_loc_sampler1[SHADER_NUM];
+static int s_loc_sampler2[SHADER_NUM];
+static int s_loc_yuv_matrix[SHADER_NUM];
+static int s_loc_yuv_offset[SHADER_NUM];
 
 void matrix_identity(float *m)
 {
@@ -816,6 +888,18 @@ int init_2d_renderer(int w, int h)
 			glGetUniformLocation(s_sobj[i].program, "u_Color");
 		s_loc_texdim[i] =
 			glGetUniformLocation(s_sobj[i].program, "u_TexDim");
+		s_loc_swizzle[i] =
+			glGetUniformLocation(s_sobj[i].program, "u_Swizzle");
+		s_loc_swizzle_const[i] = glGetUniformLocation(
+			s_sobj[i].program, "u_SwizzleConst");
+		s_loc_sampler1[i] =
+			glGetUniformLocation(s_sobj[i].program, "u_sampler1");
+		s_loc_sampler2[i] =
+			glGetUniformLocation(s_sobj[i].program, "u_sampler2");
+		s_loc_yuv_matrix[i] =
+			glGetUniformLocation(s_sobj[i].program, "u_YuvMatrix");
+		s_loc_yuv_offset[i] =
+			glGetUniformLocation(s_sobj[i].program, "u_YuvOffset");
 	}
 
 	set_2d_projection_matrix(w, h);
@@ -835,8 +919,73 @@ typedef struct _texparam {
 	int blendfunc_en;
 	unsigned int blendfunc[4]; /* src_rgb, dst_rgb, src_alpha, dst_alpha */
 	float *user_texcoord;
+	const char *swizzle;
+	const unsigned int *yuv_texid; /* chroma planes follow texid */
+	int yuv; /* RENDER2D_YUV_* */
 } texparam_t;
 
+/*
+ * swizzle lists the source of the red, green, blue and alpha output
+ * channels, each one of "rgba01". "rgb1" samples with an opaque alpha.
+ */
+static void set_swizzle(int ttype, const char *swizzle)
+{
+	static const char channels[] = "rgba";
+	float matrix[16] = { 0.0f };
+	float constant[4] = { 0.0f };
+
+	for (int i = 0; i < 4; i++) {
+		const char *src = strchr(channels, swizzle[i]);
+
+		if (swizzle[i] != '\0' && src != NULL)
+			matrix[(src - channels) * 4 + i] = 1.0f;
+		else if (swizzle[i] == '1')
+			constant[i] = 1.0f;
+	}
+	glUniformMatrix4fv(s_loc_swizzle[ttype], 1, GL_FALSE, matrix);
+	glUniform4fv(s_loc_swizzle_const[ttype], 1, constant);
+}
+
+/*
+ * Y'CbCr to R'G'B' from the luma weights of the color space, with video
+ * range scaled up to full range. Swapping U and V swaps the matrix
+ * columns.
+ */
+static void set_yuv_matrix(int ttype, int yuv)
+{
+	float kr = 0.299f, kb = 0.114f; /* BT.601 */
+	float ky = 1.0f, kc = 1.0f;
+	float offset[3] = { 0.0f, 128.0f / 255.0f, 128.0f / 255.0f };
+
+	if (yuv & RENDER2D_YUV_BT709) {
+		kr = 0.2126f;
+		kb = 0.0722f;
+	}
+	if (!(yuv & RENDER2D_YUV_FULL_RANGE)) {
+		ky = 255.0f / 219.0f;
+		kc = 255.0f / 224.0f;
+		offset[0] = 16.0f / 255.0f;
+	}
+
+	float kg = 1.0f - kr - kb;
+	float rv = 2.0f * (1.0f - kr);
+	float bu = 2.0f * (1.0f - kb);
+	float gu = -bu * kb / kg;
+	float gv = -rv * kr / kg;
+	float u[3] = { 0.0f, gu * kc, bu * kc };
+	float v[3] = { rv * kc, gv * kc, 0.0f };
+	float *cu = (yuv & RENDER2D_YUV_SWAP_UV) ? v : u;
+	float *cv = (yuv & RENDER2D_YUV_SWAP_UV) ? u : v;
+	float matrix[9] = {
+		ky, ky, ky, /* column for Y */
+		cu[0], cu[1], cu[2],
+		cv[0], cv[1], cv[2],
+	};
+
+	glUniformMatrix3fv(s_loc_yuv_matrix[ttype], 1, GL_FALSE, matrix);
+	glUniform3fv(s_loc_yuv_offset[ttype], 1, offset);
+}
+
 static void flip_texcoord(float *uv, unsigned int flip_mode)
 {
 	if (flip_mode & RENDER2D_FLIP_V) {
@@ -881,6 +1030,24 @@ static int draw_2d_texture_in(texparam_t *tparam)
 	case SHADER_TYPE_TEX:
 		glBindTexture(GL_TEXTURE_2D, texid);
 		break;
+	case SHADER_TYPE_TEX_SWIZZLE:
+		glBindTexture(GL_TEXTURE_2D, texid);
+		set_swizzle(ttype, tparam->swizzle);
+		break;
+	case SHADER_TYPE_YUV_Y_U_V:
+		glActiveTexture(GL_TEXTURE2);
+		glBindTexture(GL_TEXTURE_2D, tparam->yuv_texid[2]);
+		glUniform1i(s_loc_sampler2[ttype], 2);
+		/* fall through */
+	case SHADER_TYPE_YUV_Y_UV:
+	case SHADER_TYPE_YUV_Y_XUXV:
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, tparam->yuv_texid[1]);
+		glUniform1i(s_loc_sampler1[ttype], 1);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, texid);
+		set_yuv_matrix(ttype, tparam->yuv);
+		break;
 	default:
 		break;
 	}
@@ -961,3 +1128,64 @@ int draw_2d_texture(int texid, int x, int y, int w, int h, int upsidedown)
 
 	return 0;
 }
+
+int draw_2d_texture_swizzle(int texid, int x, int y, int w, int h,
+			    int upsidedown, const char *swizzle)
+{
+	if (swizzle == NULL || strcmp(swizzle, "rgba") == 0)
+		return draw_2d_texture(texid, x, y, w, h, upsidedown);
+
+	texparam_t tparam = { 0 };
+	tparam.x = x;
+	tparam.y = y;
+	tparam.w = w;
+	tparam.h = h;
+	tparam.texid = texid;
+	tparam.textype = SHADER_TYPE_TEX_SWIZZLE;
+	tparam.color[0] = 1.0f;
+	tparam.color[1] = 1.0f;
+	tparam.color[2] = 1.0f;
+	tparam.color[3] = 1.0f;
+	tparam.upsidedown = upsidedown;
+	tparam.swizzle = swizzle;
+	draw_2d_texture_in(&tparam);
+
+	return 0;
+}
+
+/* texid holds the planes of the layout in yuv, luma first */
+int draw_2d_texture_yuv(const unsigned int *texid, int x, int y, int w, int h,
+			int upsidedown, int yuv)
+{
+	texparam_t tparam = { 0 };
+
+	switch (yuv & RENDER2D_YUV_LAYOUT_MASK) {
+	case RENDER2D_YUV_Y_U_V:
+		tparam.textype = SHADER_TYPE_YUV_Y_U_V;
+		break;
+	case RENDER2D_YUV_Y_UV:
+		tparam.textype = SHADER_TYPE_YUV_Y_UV;
+		break;
+	case RENDER2D_YUV_Y_XUXV:
+		tparam.textype = SHADER_TYPE_YUV_Y_XUXV;
+		break;
+	default:
+		ELOG("%s unknown yuv layout %x\n", __FUNCTION__, yuv);
+		return -1;
+	}
+	tparam.x = x;
+	tparam.y = y;
+	tparam.w = w;
+	tparam.h = h;
+	tparam.texid = texid[0];
+	tparam.yuv_texid = texid;
+	tparam.yuv = yuv;
+	tparam.color[0] = 1.0f;
+	tparam.color[1] = 1.0f;
+	tparam.color[2] = 1.0f;
+	tparam.color[3] = 1.0f;
+	tparam.upsidedown = upsidedown;
+	draw_2d_texture_in(&tparam);
+
+	return 0;
+}
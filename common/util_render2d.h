@@ -22,6 +22,15 @@
 #define RENDER2D_FLIP_H (1 << 1)
 #define M_PId180f (3.1415926f / 180.0f)
 
+/* plane layouts and color flags of draw_2d_texture_yuv() */
+#define RENDER2D_YUV_Y_U_V 1 /* three planes, U and V in .r */
+#define RENDER2D_YUV_Y_UV 2 /* U and V interleaved in .r and .a */
+#define RENDER2D_YUV_Y_XUXV 3 /* Y in .r, then U and V in .g and .a */
+#define RENDER2D_YUV_LAYOUT_MASK 0x0f
+#define RENDER2D_YUV_SWAP_UV (1 << 4)
+#define RENDER2D_YUV_BT709 (1 << 5) /* BT.601 otherwise */
+#define RENDER2D_YUV_FULL_RANGE (1 << 6) /* video range otherwise */
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -29,6 +38,10 @@ extern "C" {
 int set_2d_projection_matrix(int w, int h);
 int init_2d_renderer(int w, int h);
 int draw_2d_texture(int texid, int x, int y, int w, int h, int upsidedown);
+int draw_2d_texture_swizzle(int texid, int x, int y, int w, int h,
+			    int upsidedown, const char *swizzle);
+int draw_2d_texture_yuv(const unsigned int *texid, int x, int y, int w, int h,
+			int upsidedown, int yuv);
 
 #ifdef __cplusplus
 }
@@ -19,9 +19,48 @@
 #define _WINSYS_H_
 
 #include <stdbool.h>
+#include <stdint.h>
+
+#define WINSYS_DMABUF_PLANE_MAX 4
+#define WINSYS_OVERLAY_MAX 4
+/*
+ * winsys_swap() and winsys_scanout() did not flip: the display refused the
+ * overlays it accepted in winsys_set_overlays(), they are dropped.
+ */
+#define WINSYS_OVERLAYS_REFUSED (-2)
+/* the display was busy with an earlier flip, nothing was flipped */
+#define WINSYS_FLIP_DROPPED (-3)
+
+/* client buffer handed to winsys_scanout(), fds stay owned by the caller */
+typedef struct winsys_dmabuf {
+	int32_t width;
+	int32_t height;
+	uint32_t format; /* DRM fourcc */
+	uint64_t modifier;
+	int plane_num;
+	int fd[WINSYS_DMABUF_PLANE_MAX];
+	uint32_t offset[WINSYS_DMABUF_PLANE_MAX];
+	uint32_t stride[WINSYS_DMABUF_PLANE_MAX];
+	uint64_t id; /* client buffer, keeps its import cached; 0 if not */
+} winsys_dmabuf;
+
+/* client buffer shown unscaled on an overlay plane at x, y of the output */
+typedef struct winsys_layer {
+	winsys_dmabuf buf;
+	int32_t x;
+	int32_t y;
+} winsys_layer;
 
 void *winsys_init_native_display(void);
 void *winsys_init_native_window(void *dpy, int *win_w, int *win_h, bool windowed);
 int winsys_swap(bool vsync);
+unsigned int winsys_get_refresh_mhz(void);
+int winsys_get_event_fd(void);
+int winsys_dispatch_events(void);
+bool winsys_flip_pending(void);
+int winsys_scanout(const winsys_dmabuf *buf, bool vsync);
+int winsys_get_overlay_num(void);
+int winsys_set_overlays(const winsys_layer *layers, int num);
+void winsys_forget_dmabuf(uint64_t id);
 void *winsys_create_native_pixmap(int width, int height);
 #endif /* _WINSYS_H_ */
@@ -29,6 +29,7 @@
 #include <libudev.h>
 #include "util_log.h"
 #include "winsys_drm.h"
+#include "winsys.h"
 #include "util_env.h"
 #include <libinput.h>
 #include <linux/input-event-codes.h>
@@ -38,12 +39,33 @@
 
 #define UNUSED(x) (void)(x)
 
+#ifndef DRM_FORMAT_MOD_INVALID
+#define DRM_FORMAT_MOD_INVALID 0x00ffffffffffffffULL
+#endif
+
 static int s_drm_fd;
 struct gbm_device *s_gbm;
 struct gbm_surface *s_gbm_sfc;
 modeset_dev_t *modeset_list = NULL;
 modeset_dev_t *s_modeset_dev = NULL;
 bool async_flip = false;
+static drm_fb_t *s_fb_front = NULL; /* being scanned out */
+static drm_fb_t *s_fb_pending = NULL; /* queued page flip */
+static bool s_flip_vsync = true; /* the queued flip waits for vblank */
+/* planes of the crtc, driven through atomic commits once overlays are used */
+static drm_plane_t s_primary;
+static drm_plane_t s_overlays[WINSYS_OVERLAY_MAX]; /* by zpos, bottom first */
+static int s_overlay_num = 0;
+/* last client buffer layout the display refused, not retried */
+static uint32_t s_scanout_reject_format = 0;
+static uint64_t s_scanout_reject_modifier = 0;
+/* imported client buffers by winsys_dmabuf id, oldest first */
+#define FB_CACHE_MAX 16
+static struct {
+	uint64_t id;
+	drm_fb_t *fb;
+} s_fb_cache[FB_CACHE_MAX];
+static int s_fb_cache_num = 0;
 
 static struct libinput *s_libinput = NULL;
 static pthread_t s_input_thread;
@@ -56,6 +78,8 @@ static void (*s_key_func)(int key, int state) = NULL;
 static void (*s_touch_down_func)(int32_t id, int32_t x, int32_t y) = NULL;
 static void (*s_touch_up_func)(int32_t id) = NULL;
 static void (*s_touch_motion_func)(int32_t id, int32_t x, int32_t y) = NULL;
+static void (*s_page_flip_func)(unsigned int frame, unsigned int sec,
+				unsigned int usec, bool vsync) = NULL;
 
 static void on_device_added(struct libinput_event *event)
 {
@@ -743,6 +767,142 @@ static int modeset_setup_dev(int fd, drmModeRes *res, drmModeConnector *conn,
 	return 0;
 }
 
+static int drm_plane_get_props(int fd, drm_plane_t *plane, uint64_t *type)
+{
+	drmModeObjectProperties *props = drmModeObjectGetProperties(
+		fd, plane->plane_id, DRM_MODE_OBJECT_PLANE);
+	if (props == NULL)
+		return -1;
+
+	plane->zpos = 0;
+	for (uint32_t i = 0; i < props->count_props; i++) {
+		drmModePropertyRes *prop = drmModeGetProperty(fd, props->props[i]);
+		if (prop == NULL)
+			continue;
+
+		const struct {
+			const char *name;
+			uint32_t *id;
+		} ids[] = {
+			{ "FB_ID", &plane->fb_id },   { "CRTC_ID", &plane->crtc_id },
+			{ "SRC_X", &plane->src_x },   { "SRC_Y", &plane->src_y },
+			{ "SRC_W", &plane->src_w },   { "SRC_H", &plane->src_h },
+			{ "CRTC_X", &plane->crtc_x }, { "CRTC_Y", &plane->crtc_y },
+			{ "CRTC_W", &plane->crtc_w }, { "CRTC_H", &plane->crtc_h },
+		};
+		for (size_t j = 0; j < sizeof(ids) / sizeof(ids[0]); j++) {
+			if (strcmp(prop->name, ids[j].name) == 0)
+				*ids[j].id = prop->prop_id;
+		}
+		if (strcmp(prop->name, "type") == 0)
+			*type = props->prop_values[i];
+		else if (strcmp(prop->name, "zpos") == 0)
+			plane->zpos = props->prop_values[i];
+		drmModeFreeProperty(prop);
+	}
+	drmModeFreeObjectProperties(props);
+
+	if (plane->fb_id == 0 || plane->crtc_id == 0 || plane->src_x == 0 ||
+	    plane->src_y == 0 || plane->src_w == 0 || plane->src_h == 0 ||
+	    plane->crtc_x == 0 || plane->crtc_y == 0 || plane->crtc_w == 0 ||
+	    plane->crtc_h == 0)
+		return -1;
+	return 0;
+}
+
+static int drm_plane_cmp(const void *a, const void *b)
+{
+	const drm_plane_t *pa = a, *pb = b;
+
+	if (pa->zpos != pb->zpos)
+		return pa->zpos < pb->zpos ? -1 : 1;
+	return pa->plane_id < pb->plane_id ? -1 : 1;
+}
+
+/*
+ * Collect the primary and the overlay planes of the crtc. Overlays are
+ * only placed through atomic commits, which can test a configuration
+ * without showing it; without atomic support the primary plane stays
+ * driven by the legacy calls alone.
+ */
+static void drm_planes_init(int fd, drmModeRes *res, modeset_dev_t *dev)
+{
+	int overlay_max = getenv_int("EGLWINSYS_DRM_OVERLAYS",
+				     WINSYS_OVERLAY_MAX);
+	uint32_t crtc_mask = 0;
+
+	if (overlay_max <= 0)
+		return;
+	if (overlay_max > WINSYS_OVERLAY_MAX)
+		overlay_max = WINSYS_OVERLAY_MAX;
+	if (drmSetClientCap(fd, DRM_CLIENT_CAP_ATOMIC, 1) != 0) {
+		ILOG("no atomic modesetting, overlay planes are not used\n");
+		return;
+	}
+
+	for (int i = 0; i < res->count_crtcs; i++) {
+		if (res->crtcs[i] == dev->crtc)
+			crtc_mask = 1 << i;
+	}
+	drmModePlaneRes *planes = drmModeGetPlaneResources(fd);
+	if (planes == NULL) {
+		ELOG("%s drmModeGetPlaneResources\n", __FUNCTION__);
+		return;
+	}
+
+	for (uint32_t i = 0; i < planes->count_planes; i++) {
+		drmModePlane *p = drmModeGetPlane(fd, planes->planes[i]);
+		if (p == NULL)
+			continue;
+
+		drm_plane_t plane = { .plane_id = p->plane_id };
+		uint64_t type = DRM_PLANE_TYPE_CURSOR;
+		if (!(p->possible_crtcs & crtc_mask) ||
+		    drm_plane_get_props(fd, &plane, &type) == -1 ||
+		    (type == DRM_PLANE_TYPE_OVERLAY &&
+		     s_overlay_num == overlay_max) ||
+		    (type == DRM_PLANE_TYPE_PRIMARY && s_primary.plane_id)) {
+			drmModeFreePlane(p);
+			continue;
+		}
+		if (type == DRM_PLANE_TYPE_PRIMARY) {
+			s_primary = plane;
+		} else if (type == DRM_PLANE_TYPE_OVERLAY) {
+			plane.formats = malloc(p->count_formats *
+					       sizeof(plane.formats[0]));
+			if (plane.formats) {
+				memcpy(plane.formats, p->formats,
+				       p->count_formats *
+					       sizeof(plane.formats[0]));
+				plane.format_num = p->count_formats;
+				s_overlays[s_overlay_num++] = plane;
+			}
+		}
+		drmModeFreePlane(p);
+	}
+	drmModeFreePlaneResources(planes);
+
+	qsort(s_overlays, s_overlay_num, sizeof(s_overlays[0]), drm_plane_cmp);
+	if (s_primary.plane_id == 0) {
+		for (int i = 0; i < s_overlay_num; i++)
+			free(s_overlays[i].formats);
+		s_overlay_num = 0;
+	}
+	/* underlays would need holes punched into the composited frame */
+	while (s_overlay_num > 0 && s_overlays[0].zpos < s_primary.zpos) {
+		free(s_overlays[0].formats);
+		memmove(&s_overlays[0], &s_overlays[1],
+			--s_overlay_num * sizeof(s_overlays[0]));
+	}
+
+	for (int i = 0; i < s_overlay_num; i++)
+		ILOG("overlay plane[%d]: id(%u) zpos(%llu) formats(%u)\n", i,
+		     s_overlays[i].plane_id,
+		     (unsigned long long)s_overlays[i].zpos,
+		     s_overlays[i].format_num);
+	ILOG("overlay planes: %d\n", s_overlay_num);
+}
+
 static int create_drm_device(int *win_w, int *win_h, bool windowed)
 {
 	int drm_fd = s_drm_fd;
@@ -806,6 +966,8 @@ static int create_drm_device(int *win_w, int *win_h, bool windowed)
 	if (s_modeset_dev == NULL) {
 		ELOG("can't find connector.\n");
 		ret = -1;
+	} else {
+		drm_planes_init(drm_fd, res, s_modeset_dev);
 	}
 
 	drmModeFreeResources(res);
@@ -884,19 +1046,376 @@ static struct drm_fb *drm_fb_get_from_bo(int drm_fd, struct gbm_bo *bo,
 	return fb;
 }
 
+/*
+ * Client buffers are destroyed with their last reference, ours go back
+ * to the gbm surface.
+ */
+static void drm_fb_release(struct drm_fb *fb)
+{
+	if (!fb->scanout)
+		gbm_surface_release_buffer(s_gbm_sfc, fb->bo);
+	else if (--fb->ref_count == 0)
+		gbm_bo_destroy(fb->bo);
+}
+
+static void drm_fb_cache_remove(int i)
+{
+	drm_fb_t *fb = s_fb_cache[i].fb;
+
+	s_fb_cache_num--;
+	memmove(&s_fb_cache[i], &s_fb_cache[i + 1],
+		(s_fb_cache_num - i) * sizeof(s_fb_cache[0]));
+	drm_fb_release(fb);
+}
+
+static drm_fb_t *drm_fb_cache_lookup(uint64_t id)
+{
+	for (int i = 0; id && i < s_fb_cache_num; i++) {
+		if (s_fb_cache[i].id == id)
+			return s_fb_cache[i].fb;
+	}
+	return NULL;
+}
+
+static void drm_fb_cache_add(uint64_t id, drm_fb_t *fb)
+{
+	if (id == 0)
+		return;
+	if (s_fb_cache_num == FB_CACHE_MAX)
+		drm_fb_cache_remove(0);
+	fb->ref_count++;
+	s_fb_cache[s_fb_cache_num].id = id;
+	s_fb_cache[s_fb_cache_num].fb = fb;
+	s_fb_cache_num++;
+}
+
+static void drm_fb_scanout_destroy_callback(struct gbm_bo *bo, void *data)
+{
+	struct drm_fb *fb = data;
+
+	if (fb->fb_id)
+		drmModeRmFB(s_drm_fd, fb->fb_id);
+	free(fb);
+}
+
+/*
+ * The returned buffer holds a reference for the caller. Buffers with an
+ * id are imported once and reused for every flip and TEST_ONLY commit,
+ * until winsys_forget_dmabuf().
+ */
+static struct drm_fb *drm_fb_import(const winsys_dmabuf *buf)
+{
+	drm_fb_t *cached = drm_fb_cache_lookup(buf->id);
+	if (cached) {
+		cached->ref_count++;
+		return cached;
+	}
+
+	struct gbm_import_fd_modifier_data data = {
+		.width = buf->width,
+		.height = buf->height,
+		.format = buf->format,
+		.num_fds = buf->plane_num,
+		.modifier = buf->modifier,
+	};
+	unsigned int handles[4] = { 0 }, pitches[4] = { 0 }, offsets[4] = { 0 };
+	uint64_t modifiers[4] = { 0 };
+	uint32_t flags = 0;
+
+	for (int i = 0; i < buf->plane_num; i++) {
+		data.fds[i] = buf->fd[i];
+		data.strides[i] = buf->stride[i];
+		data.offsets[i] = buf->offset[i];
+	}
+
+	struct gbm_bo *bo = gbm_bo_import(s_gbm, GBM_BO_IMPORT_FD_MODIFIER,
+					  &data, GBM_BO_USE_SCANOUT);
+	if (bo == NULL)
+		return NULL;
+
+	struct drm_fb *fb = calloc(1, sizeof(*fb));
+	if (fb == NULL) {
+		gbm_bo_destroy(bo);
+		return NULL;
+	}
+	fb->bo = bo;
+	fb->width = buf->width;
+	fb->height = buf->height;
+	fb->stride = buf->stride[0];
+	fb->prime_fd = -1;
+	fb->bo_fd = -1;
+	fb->scanout = true;
+	fb->ref_count = 1;
+
+	for (int i = 0; i < buf->plane_num; i++) {
+		handles[i] = gbm_bo_get_handle_for_plane(bo, i).u32;
+		pitches[i] = buf->stride[i];
+		offsets[i] = buf->offset[i];
+		if (buf->modifier != DRM_FORMAT_MOD_INVALID)
+			modifiers[i] = buf->modifier;
+	}
+	if (buf->modifier != DRM_FORMAT_MOD_INVALID)
+		flags = DRM_MODE_FB_MODIFIERS;
+	fb->handle = handles[0];
+
+	if (drmModeAddFB2WithModifiers(s_drm_fd, fb->width, fb->height,
+				       buf->format, handles, pitches, offsets,
+				       modifiers, &fb->fb_id, flags)) {
+		DLOG("%s drmModeAddFB2WithModifiers: %s\n", __FUNCTION__,
+		     strerror(errno));
+		free(fb);
+		gbm_bo_destroy(bo);
+		return NULL;
+	}
+	gbm_bo_set_user_data(bo, fb, drm_fb_scanout_destroy_callback);
+	drm_fb_cache_add(buf->id, fb);
+	return fb;
+}
+
+static void drm_plane_add(drmModeAtomicReq *req, drm_plane_t *plane,
+			  drm_fb_t *fb)
+{
+	uint32_t id = plane->plane_id;
+
+	if (fb == NULL) {
+		drmModeAtomicAddProperty(req, id, plane->fb_id, 0);
+		drmModeAtomicAddProperty(req, id, plane->crtc_id, 0);
+		return;
+	}
+	drmModeAtomicAddProperty(req, id, plane->fb_id, fb->fb_id);
+	drmModeAtomicAddProperty(req, id, plane->crtc_id, s_modeset_dev->crtc);
+	drmModeAtomicAddProperty(req, id, plane->src_x, 0);
+	drmModeAtomicAddProperty(req, id, plane->src_y, 0);
+	drmModeAtomicAddProperty(req, id, plane->src_w,
+				 (uint64_t)plane->width << 16);
+	drmModeAtomicAddProperty(req, id, plane->src_h,
+				 (uint64_t)plane->height << 16);
+	drmModeAtomicAddProperty(req, id, plane->crtc_x, plane->x);
+	drmModeAtomicAddProperty(req, id, plane->crtc_y, plane->y);
+	drmModeAtomicAddProperty(req, id, plane->crtc_w, plane->width);
+	drmModeAtomicAddProperty(req, id, plane->crtc_h, plane->height);
+}
+
+/* the primary buffer and the staged overlays in a single commit */
+static int drm_atomic_commit(drm_fb_t *primary, uint32_t flags)
+{
+	drmModeAtomicReq *req = drmModeAtomicAlloc();
+	if (req == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	drmModeAtomicAddProperty(req, s_primary.plane_id, s_primary.fb_id,
+				 primary->fb_id);
+	for (int i = 0; i < s_overlay_num; i++)
+		drm_plane_add(req, &s_overlays[i], s_overlays[i].fb_staged);
+	int ret = drmModeAtomicCommit(s_drm_fd, req, flags, NULL);
+	drmModeAtomicFree(req);
+	return ret;
+}
+
+static bool drm_overlays_staged(void)
+{
+	for (int i = 0; i < s_overlay_num; i++) {
+		if (s_overlays[i].fb_staged)
+			return true;
+	}
+	return false;
+}
+
+static bool drm_overlays_used(void)
+{
+	for (int i = 0; i < s_overlay_num; i++) {
+		if (s_overlays[i].fb_staged || s_overlays[i].fb_pending ||
+		    s_overlays[i].fb_front)
+			return true;
+	}
+	return false;
+}
+
+/* forget the staged buffers without releasing them */
+static void drm_overlays_clear(void)
+{
+	for (int i = 0; i < s_overlay_num; i++)
+		s_overlays[i].fb_staged = NULL;
+}
+
+static void drm_overlays_unstage(void)
+{
+	for (int i = 0; i < s_overlay_num; i++) {
+		if (s_overlays[i].fb_staged)
+			drm_fb_release(s_overlays[i].fb_staged);
+		s_overlays[i].fb_staged = NULL;
+	}
+}
+
+/*
+ * Assign the layers, bottom to top, to overlay planes of increasing zpos
+ * that can scan out their format. The buffers stay owned by the caller.
+ */
+static int drm_overlays_stage(const winsys_layer *layers, drm_fb_t **fbs,
+			      int num)
+{
+	struct modeset_dev *dev = s_modeset_dev;
+	int k = 0;
+
+	drm_overlays_clear();
+
+	for (int i = 0; i < s_overlay_num && k < num; i++) {
+		drm_plane_t *plane = &s_overlays[i];
+		const winsys_layer *layer = &layers[k];
+		bool supported = false;
+
+		for (uint32_t j = 0; j < plane->format_num; j++) {
+			if (plane->formats[j] == layer->buf.format)
+				supported = true;
+		}
+		if (!supported)
+			continue;
+		if (layer->x < 0 || layer->y < 0 ||
+		    layer->x >= dev->mode.hdisplay ||
+		    layer->y >= dev->mode.vdisplay)
+			break;
+
+		/* the part beyond the mode is cropped, not scaled */
+		int32_t avail_w = dev->mode.hdisplay - layer->x;
+		int32_t avail_h = dev->mode.vdisplay - layer->y;
+
+		plane->x = layer->x;
+		plane->y = layer->y;
+		plane->width = layer->buf.width;
+		if (plane->width > (uint32_t)avail_w)
+			plane->width = avail_w;
+		plane->height = layer->buf.height;
+		if (plane->height > (uint32_t)avail_h)
+			plane->height = avail_h;
+		plane->fb_staged = fbs[k++];
+	}
+	if (k == num)
+		return 0;
+
+	drm_overlays_clear();
+	return -1;
+}
+
+/*
+ * drmModePageFlip() replacement taking the overlays along. Atomic commits
+ * cannot flip asynchronously here, vsync is always waited for while any
+ * overlay is in use. The overlays were tested with another primary
+ * buffer: if the display refuses them now, nothing is flipped, the frame
+ * would miss the surfaces they show.
+ */
+static int drm_page_flip(drm_fb_t *fb, unsigned int flip_mode)
+{
+	uint32_t flags = DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT;
+
+	if (!drm_overlays_used()) {
+		s_flip_vsync = !(flip_mode & DRM_MODE_PAGE_FLIP_ASYNC);
+		return drmModePageFlip(s_drm_fd, s_modeset_dev->crtc,
+				       fb->fb_id, flip_mode, NULL);
+	}
+
+	int ret = drm_atomic_commit(fb, flags);
+	if (ret < 0 && drm_overlays_staged()) {
+		int err = errno;
+
+		drm_overlays_unstage();
+		errno = err;
+		if (err != EBUSY) {
+			DLOG("%s overlays refused: %s\n", __FUNCTION__,
+			     strerror(err));
+			return WINSYS_OVERLAYS_REFUSED;
+		}
+	}
+	if (ret < 0)
+		return ret;
+
+	s_flip_vsync = true;
+	for (int i = 0; i < s_overlay_num; i++) {
+		s_overlays[i].fb_pending = s_overlays[i].fb_staged;
+		s_overlays[i].fb_staged = NULL;
+	}
+	return 0;
+}
+
 void page_flip_handler(int fd, unsigned int frame, unsigned int sec,
 		       unsigned int usec, void *data)
 {
-	int *waiting_for_flip = data;
-	*waiting_for_flip = 0;
+	/* the previous front buffer has left the screen */
+	if (s_fb_front) {
+		drm_fb_release(s_fb_front);
+	}
+	s_fb_front = s_fb_pending;
+	s_fb_pending = NULL;
+
+	for (int i = 0; i < s_overlay_num; i++) {
+		drm_plane_t *plane = &s_overlays[i];
+
+		if (plane->fb_front)
+			drm_fb_release(plane->fb_front);
+		plane->fb_front = plane->fb_pending;
+		plane->fb_pending = NULL;
+	}
+
+	if (s_page_flip_func) {
+		s_page_flip_func(frame, sec, usec, s_flip_vsync);
+	}
+}
+
+unsigned int winsys_get_refresh_mhz(void)
+{
+	struct modeset_dev *dev = s_modeset_dev;
+	if (dev == NULL || dev->mode.htotal == 0 || dev->mode.vtotal == 0)
+		return 0;
+
+	/* mode.clock is in kHz */
+	uint64_t refresh = (uint64_t)dev->mode.clock * 1000000 /
+			   dev->mode.htotal;
+	return (refresh + dev->mode.vtotal / 2) / dev->mode.vtotal;
+}
+
+int winsys_get_event_fd(void)
+{
+	return s_drm_fd;
 }
 
+int winsys_dispatch_events(void)
+{
+	drmEventContext evctx = {
+		.version = DRM_EVENT_CONTEXT_VERSION,
+		.page_flip_handler = page_flip_handler,
+	};
+
+	if (drmHandleEvent(s_drm_fd, &evctx) < 0) {
+		ELOG("Failed to handle DRM event: %s\n", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+bool winsys_flip_pending(void)
+{
+	return s_fb_pending != NULL;
+}
+
+/*
+ * Queue a page flip and return without waiting for it. The flip event
+ * is delivered through winsys_dispatch_events() once the DRM fd becomes
+ * readable; the buffer leaving the screen is released there. With
+ * WINSYS_OVERLAYS_REFUSED or WINSYS_FLIP_DROPPED the frame is dropped and
+ * has to be drawn again.
+ */
 int winsys_swap(bool vsync)
 {
 	int ret;
-	static drm_fb_t *s_fb_del = NULL;
 	struct modeset_dev *dev = s_modeset_dev;
 
+	/* callers are expected to wait for the flip event */
+	while (s_fb_pending) {
+		if (winsys_dispatch_events() < 0)
+			return -1;
+	}
+
 	struct gbm_bo *bo_next = gbm_surface_lock_front_buffer(s_gbm_sfc);
 	if (!bo_next) {
 		ELOG("%s\n", __FUNCTION__);
@@ -909,12 +1428,8 @@ int winsys_swap(bool vsync)
 		ELOG("%s\n", __FUNCTION__);
 		return -1;
 	}
-	int waiting_for_flip = 0;
-	drmEventContext evctx = {
-		.version = DRM_EVENT_CONTEXT_VERSION,
-		.page_flip_handler = page_flip_handler,
-	};
-	if (s_fb_del == NULL) {
+
+	if (s_fb_front == NULL) {
 		ret = drmModeSetCrtc(s_drm_fd, dev->crtc, fb_next->fb_id, 0, 0,
 				     &dev->conn, 1, &dev->mode);
 		if (ret) {
@@ -923,49 +1438,154 @@ int winsys_swap(bool vsync)
 			gbm_surface_release_buffer(s_gbm_sfc, bo_next);
 			return -1;
 		}
-	} else {
-		unsigned int flip_mode = 0;
-		if (!vsync && async_flip) {
-			flip_mode |= DRM_MODE_PAGE_FLIP_ASYNC;
-		}
+		s_fb_front = fb_next;
+		return 0;
+	}
 
-		if (vsync) {
-			flip_mode |= DRM_MODE_PAGE_FLIP_EVENT;
-		}
+	/* the event is needed to know when the old buffer can be reused */
+	unsigned int flip_mode = DRM_MODE_PAGE_FLIP_EVENT;
+	if (!vsync && async_flip && !s_fb_front->scanout) {
+		flip_mode |= DRM_MODE_PAGE_FLIP_ASYNC;
+	}
 
-		ret = drmModePageFlip(s_drm_fd, dev->crtc, fb_next->fb_id,
-				      flip_mode, &waiting_for_flip);
-		if (ret < 0) {
-			gbm_surface_release_buffer(s_gbm_sfc, fb_next->bo);
-			if (errno != EBUSY) {
-				ELOG("ERR:%s(%d):%s\n", __FILE__, __LINE__,
-				     strerror(errno));
-				return -1;
-			}
+	ret = drm_page_flip(fb_next, flip_mode);
+	if (ret < 0) {
+		gbm_surface_release_buffer(s_gbm_sfc, fb_next->bo);
+		if (ret == WINSYS_OVERLAYS_REFUSED)
+			return ret;
+		if (errno != EBUSY) {
+			ELOG("ERR:%s(%d):%s\n", __FILE__, __LINE__,
+			     strerror(errno));
+			return -1;
 		}
+		return WINSYS_FLIP_DROPPED;
+	}
 
-		if (vsync) {
-			waiting_for_flip = 1;
-			while (waiting_for_flip) {
-				ret = drmHandleEvent(s_drm_fd, &evctx);
-				if (ret < 0) {
-					ELOG("Failed to handle DRM event: %s\n",
-					     strerror(errno));
-					gbm_surface_release_buffer(s_gbm_sfc,
-								   fb_next->bo);
-					return -1;
-				}
-			}
-		}
+	s_fb_pending = fb_next;
+	return 0;
+}
+
+/*
+ * Flip to a client buffer instead of a composited frame. Only a buffer
+ * covering the whole mode is taken: the primary plane is driven through
+ * the legacy API, which can neither scale nor position it. Returns -1
+ * without touching the screen when the buffer cannot be shown, the caller
+ * then composites the frame as usual. WINSYS_OVERLAYS_REFUSED is returned
+ * when the display refuses the overlays staged for the flip, the frame is
+ * then composited with every surface on the primary plane. The buffer is
+ * read by the display until the flip following this one has completed.
+ */
+int winsys_scanout(const winsys_dmabuf *buf, bool vsync)
+{
+	struct modeset_dev *dev = s_modeset_dev;
+
+	/* the first frame sets the CRTC up through winsys_swap() */
+	if (dev == NULL || s_fb_front == NULL)
+		return -1;
+	if (buf->width != dev->mode.hdisplay ||
+	    buf->height != dev->mode.vdisplay)
+		return -1;
+	if (buf->format == s_scanout_reject_format &&
+	    buf->modifier == s_scanout_reject_modifier)
+		return -1;
+
+	while (s_fb_pending) {
+		if (winsys_dispatch_events() < 0)
+			return -1;
+	}
+
+	struct drm_fb *fb_next = drm_fb_import(buf);
+	if (fb_next == NULL) {
+		s_scanout_reject_format = buf->format;
+		s_scanout_reject_modifier = buf->modifier;
+		return -1;
+	}
+
+	/* async flips cannot change the buffer layout on most drivers */
+	unsigned int flip_mode = DRM_MODE_PAGE_FLIP_EVENT;
+	if (!vsync && async_flip && s_fb_front->scanout) {
+		flip_mode |= DRM_MODE_PAGE_FLIP_ASYNC;
 	}
 
-	s_fb_del = fb_next;
-	if (s_fb_del) {
-		gbm_surface_release_buffer(s_gbm_sfc, s_fb_del->bo);
+	int ret = drm_page_flip(fb_next, flip_mode);
+	if (ret == WINSYS_OVERLAYS_REFUSED) {
+		drm_fb_release(fb_next);
+		return ret;
+	}
+	if (ret < 0) {
+		int err = errno;
+
+		drm_fb_release(fb_next);
+		if (err == EBUSY)
+			return WINSYS_FLIP_DROPPED;
+		DLOG("%s drmModePageFlip: %s\n", __FUNCTION__, strerror(err));
+		s_scanout_reject_format = buf->format;
+		s_scanout_reject_modifier = buf->modifier;
+		return -1;
 	}
-	s_fb_del = fb_next;
+
+	s_fb_pending = fb_next;
 	return 0;
 }
+
+int winsys_get_overlay_num(void)
+{
+	return s_overlay_num;
+}
+
+/*
+ * Put the topmost of the layers, given bottom to top, on overlay planes
+ * from the next flip on. The configuration is checked with TEST_ONLY
+ * commits on top of the current primary buffer, leaving out layers from
+ * the bottom until the display accepts it. Returns the number of layers
+ * placed, the others are to be composited into the primary plane. Like
+ * with winsys_scanout(), the buffers are read until the flip following
+ * the next one has completed.
+ */
+int winsys_set_overlays(const winsys_layer *layers, int num)
+{
+	drm_fb_t *fbs[WINSYS_OVERLAY_MAX] = { NULL };
+	int first = 0;
+
+	drm_overlays_unstage();
+	if (s_overlay_num == 0 || s_fb_front == NULL)
+		return 0;
+	if (num > s_overlay_num) {
+		layers += num - s_overlay_num;
+		num = s_overlay_num;
+	}
+
+	/* a layer that cannot be imported keeps the ones below off too */
+	for (int i = num - 1; i >= 0; i--) {
+		fbs[i] = drm_fb_import(&layers[i].buf);
+		if (fbs[i] == NULL) {
+			first = i + 1;
+			break;
+		}
+	}
+	for (; first < num; first++) {
+		if (drm_overlays_stage(&layers[first], &fbs[first],
+				       num - first) == 0 &&
+		    drm_atomic_commit(s_fb_front, DRM_MODE_ATOMIC_TEST_ONLY) ==
+			    0)
+			break;
+		drm_overlays_clear();
+		drm_fb_release(fbs[first]);
+	}
+	return num - first;
+}
+
+/* the client buffer is gone: its import is dropped once off the screen */
+void winsys_forget_dmabuf(uint64_t id)
+{
+	for (int i = 0; i < s_fb_cache_num; i++) {
+		if (s_fb_cache[i].id == id) {
+			drm_fb_cache_remove(i);
+			return;
+		}
+	}
+}
+
 void *winsys_create_native_pixmap(int width, int height)
 {
 	return NULL;
@@ -1000,3 +1620,9 @@ void egl_set_touch_motion_func(void (*func)(int id, int x, int y))
 {
 	s_touch_motion_func = func;
 }
+
+void egl_set_page_flip_func(void (*func)(unsigned int frame, unsigned int sec,
+					 unsigned int usec, bool vsync))
+{
+	s_page_flip_func = func;
+}
@@ -20,6 +20,7 @@
 
 #include <xf86drm.h>
 #include <xf86drmMode.h>
+#include <stdbool.h>
 #include <gbm.h>
 
 #define MAX_DEVICES 100
@@ -49,6 +50,26 @@ typedef struct drm_fb {
 	int prime_fd;
 	struct gbm_bo *bo;
 	int bo_fd; /* for client */
+	bool scanout; /* client buffer imported by winsys_scanout() */
+	int ref_count; /* client buffer: flips and the import cache */
 } drm_fb_t;
 
+typedef struct drm_plane {
+	uint32_t plane_id;
+	uint64_t zpos;
+	uint32_t *formats;
+	uint32_t format_num;
+	/* property ids */
+	uint32_t fb_id, crtc_id;
+	uint32_t src_x, src_y, src_w, src_h;
+	uint32_t crtc_x, crtc_y, crtc_w, crtc_h;
+
+	/* overlays: layer set up by winsys_set_overlays() for the next flip */
+	drm_fb_t *fb_staged;
+	int32_t x, y;
+	uint32_t width, height; /* clipped to the mode */
+	drm_fb_t *fb_pending; /* shown by the queued flip */
+	drm_fb_t *fb_front; /* being scanned out */
+} drm_plane_t;
+
 #endif /* WINSYS_DRM_H_ */
@@ -25,6 +25,7 @@
 #include "wayland-egl.h"
 #include "util_log.h"
 #include "winsys_wayland.h"
+#include "winsys.h"
 #include <pthread.h>
 #include <errno.h>
 #include <poll.h>
@@ -495,6 +496,46 @@ int winsys_swap(bool vsync)
 	return 0;
 }
 
+unsigned int winsys_get_refresh_mhz(void)
+{
+	return 0;
+}
+
+/* swaps complete synchronously, there is no event fd to watch */
+int winsys_get_event_fd(void)
+{
+	return -1;
+}
+
+int winsys_dispatch_events(void)
+{
+	return 0;
+}
+
+bool winsys_flip_pending(void)
+{
+	return false;
+}
+
+int winsys_scanout(const winsys_dmabuf *buf, bool vsync)
+{
+	return -1;
+}
+
+int winsys_get_overlay_num(void)
+{
+	return 0;
+}
+
+int winsys_set_overlays(const winsys_layer *layers, int num)
+{
+	return 0;
+}
+
+void winsys_forget_dmabuf(uint64_t id)
+{
+}
+
 void *winsys_create_native_pixmap(int width, int height)
 {
 	return NULL;
@@ -529,3 +570,10 @@ void egl_set_touch_motion_func(void (*func)(int id, int x, int y))
 {
 	s_touch_motion_func = func;
 }
+
+void egl_set_page_flip_func(void (*func)(unsigned int frame, unsigned int sec,
+					 unsigned int usec, bool vsync))
+{
+	/* no page flip events on this window system */
+	(void)func;
+}
@@ -351,6 +351,46 @@ int winsys_swap(bool vsync)
 	return 0;
 }
 
+unsigned int winsys_get_refresh_mhz(void)
+{
+	return 0;
+}
+
+/* swaps complete synchronously, there is no event fd to watch */
+int winsys_get_event_fd(void)
+{
+	return -1;
+}
+
+int winsys_dispatch_events(void)
+{
+	return 0;
+}
+
+bool winsys_flip_pending(void)
+{
+	return false;
+}
+
+int winsys_scanout(const winsys_dmabuf *buf, bool vsync)
+{
+	return -1;
+}
+
+int winsys_get_overlay_num(void)
+{
+	return 0;
+}
+
+int winsys_set_overlays(const winsys_layer *layers, int num)
+{
+	return 0;
+}
+
+void winsys_forget_dmabuf(uint64_t id)
+{
+}
+
 void *winsys_create_native_pixmap(int width, int height)
 {
 	return NULL;
@@ -370,3 +410,10 @@ void egl_set_key_func(void (*func)(int key, int state))
 {
 	s_key_func = func;
 }
+
+void egl_set_page_flip_func(void (*func)(unsigned int frame, unsigned int sec,
+					 unsigned int usec, bool vsync))
+{
+	/* no page flip events on this window system */
+	(void)func;
+}
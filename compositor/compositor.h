@@ -22,8 +22,14 @@
 #include <xkbcommon/xkbcommon.h>
 #include <GLES2/gl2.h>
 #include <pthread.h>
+#include "render_queue.h"
 
-#define TEX_PLANE_NUM 2
+#define TEX_SLOT_MAX 4
+#define TEX_PLANE_MAX 3
+#define DAMAGE_RECT_MAX 8
+#define PBO_RING_SIZE 3
+#define DMABUF_PLANE_MAX 4
+#define SCANOUT_MAX (1 + WINSYS_OVERLAY_MAX) /* primary and overlays */
 
 struct xkb_info {
 	struct xkb_keymap *keymap;
@@ -52,12 +58,166 @@ typedef struct {
 	struct wl_listener destroy_listener;
 } client_data;
 
+typedef struct repaint_scheduler {
+	struct wl_event_source *timer;
+	bool timer_armed;
+	uint64_t last_vblank_nsec; /* CLOCK_MONOTONIC of the last page flip */
+	uint64_t refresh_nsec;
+	uint64_t window_nsec; /* repaint starts this long before vblank */
+	uint64_t max_window_nsec;
+	uint64_t peak_composite_nsec;
+} repaint_scheduler;
+
+typedef struct damage_rect {
+	int32_t x, y, w, h;
+} damage_rect;
+
+typedef struct damage {
+	bool full;
+	int num;
+	damage_rect rects[DAMAGE_RECT_MAX];
+} damage;
+
+/* per-surface hashes of TILE_SIZE tiles, see tile_hash.c */
+typedef struct tile_grid {
+	uint64_t *hash;
+	int32_t cols, rows;
+	int32_t width, height; /* 0 while the hashes are invalid */
+	uint32_t format;
+} tile_grid;
+
+struct render_commit;
+
+typedef enum {
+	RENDER_EVENT_FRAME, /* an output frame was presented */
+	RENDER_EVENT_RELEASE, /* the shm content was copied */
+	RENDER_EVENT_SUPERSEDE, /* replaced by a newer commit of the surface */
+	RENDER_EVENT_RETIRE, /* the commit is no longer used */
+	RENDER_EVENT_EXIT, /* the render thread has stopped */
+} render_event_type;
+
+/* render thread -> dispatch thread */
+typedef struct render_event {
+	render_queue_node node;
+	render_event_type type;
+	struct render_commit *commit;
+} render_event;
+
+/*
+ * Everything answered by one presented output frame, so that frame
+ * callbacks and presentation feedback of all clients go out in one flush.
+ * Allocated by the render thread, freed by the dispatch thread.
+ */
+typedef struct render_frame {
+	render_event event;
+	uint32_t time_msec; /* vblank, CLOCK_MONOTONIC */
+	int entry_num;
+	struct {
+		struct render_commit *commit;
+		bool presented; /* feedback, otherwise frame callbacks */
+	} entries[];
+} render_frame;
+
+typedef enum {
+	TIMELINE_COMMIT, /* wl_surface.commit received */
+	TIMELINE_COPY, /* shm content copied or prefetched by a worker */
+	TIMELINE_UPLOAD, /* texture upload issued */
+	TIMELINE_FENCE, /* upload fence signaled */
+	TIMELINE_DRAW, /* first composited */
+	TIMELINE_SWAP, /* eglSwapBuffers returned */
+	TIMELINE_FLIP, /* page flip completed */
+	TIMELINE_STAGE_NUM,
+} timeline_stage;
+
+struct compositor_surface;
+struct linux_drm_syncobj_timeline;
+
+/* timeline point of wp_linux_drm_syncobj_surface_v1 */
+typedef struct linux_drm_syncobj_point {
+	struct linux_drm_syncobj_timeline *timeline; /* NULL while unset */
+	uint64_t value;
+} linux_drm_syncobj_point;
+
+/* one texture of the per-surface ring, fenced on its own */
+typedef struct tex_slot {
+	struct compositor_surface *csfc;
+	GLuint texid[TEX_PLANE_MAX]; /* planes of YUV content */
+	int status;
+	uint32_t seq; /* upload order within the surface */
+	struct render_commit *commit; /* uploading into or shown from */
+	struct render_commit *replaced; /* single slot: overwritten commit */
+	int32_t tex_w; /* allocated shm texture, 0 for an EGLImage */
+	int32_t tex_h;
+	uint32_t tex_format;
+	const char *tex_swizzle; /* sampled channels, NULL for an EGLImage */
+	int tex_yuv; /* RENDER2D_YUV_* layout and color, 0 for RGB */
+	bool tex_immutable; /* glTexStorage2D */
+	damage stale; /* changed since the slot was last written */
+	GLsync glsyncobj_tex;
+	int fence_fd; /* native fence of the in-flight upload */
+	struct wl_event_source *fence_source;
+	struct wl_list upload_link; /* render_context upload_list */
+} tex_slot;
+
+/* hot state of a mapped surface, packed in z-order for the repaint */
+typedef struct render_draw {
+	GLuint texid[TEX_PLANE_MAX]; /* [0] is 0 until the first upload */
+	const char *swizzle;
+	int yuv;
+	int32_t width;
+	int32_t height;
+	struct render_commit *commit; /* shown commit */
+	struct compositor_surface *csfc;
+} render_draw;
+
+typedef struct render_context {
+	pthread_t thread;
+	struct wl_event_loop *loop;
+	render_queue commit_queue; /* dispatch thread -> render thread */
+	render_queue event_queue; /* render thread -> dispatch thread */
+	render_queue copy_queue; /* copy workers -> render thread */
+	struct wl_event_source *commit_source;
+	struct wl_event_source *copy_source;
+	struct wl_event_source *display_source; /* page flip events */
+	render_event exit_event;
+
+	/* owned by the render thread */
+	bool running;
+	bool vsync;
+	bool need_repaint;
+	int tex_slot_num; /* texture ring depth of new surfaces */
+	bool pbo_upload; /* shm uploads through the pixel buffer ring */
+	bool tile_hash; /* skip shm tiles whose content did not change */
+	bool scanout; /* show dmabufs on planes without composition */
+	int overlay_num; /* overlay planes offered by the window system */
+	/* commits read by the display, see render_scanout_flipped() */
+	struct render_commit *scanout_front[SCANOUT_MAX];
+	int scanout_front_num;
+	struct render_commit *scanout_pending[SCANOUT_MAX];
+	int scanout_pending_num;
+	GLuint pbo[PBO_RING_SIZE];
+	size_t pbo_size[PBO_RING_SIZE]; /* grows to the largest upload */
+	int pbo_next;
+	uint8_t *convert_buf; /* converted rows without pbo */
+	size_t convert_size;
+	render_draw *draws; /* mapped surfaces, bottom to top */
+	int draw_num;
+	int draw_cap;
+	struct wl_list upload_list; /* slots polling an upload fence */
+	struct wl_list done_list; /* frame callbacks for the next repaint */
+	struct wl_list done_flip_list; /* frame callbacks for the pending flip */
+	struct wl_list present_list; /* commits shown by the pending flip */
+	struct wl_event_source *fence_timer; /* fallback upload fence poll */
+	repaint_scheduler repaint;
+} render_context;
+
 typedef struct compositor {
 	struct wl_resource *resource;
 	struct wl_display *wl_display;
 	struct wl_global *wl_shell;
 	struct wl_list client_list;
 	struct wl_list surface_list;
+	struct wl_list output_list; /* bound wl_output resources */
 	pthread_mutex_t event_mutex;
 	int width; /* compositor width  */
 	int height; /* compositor height */
@@ -72,8 +232,49 @@ typedef struct compositor {
 	struct xkb_rule_names xkb_names;
 	struct xkb_context *xkb_context;
 	struct xkb_info *xkb_info;
+	EGLDisplay egl_display;
+	bool running;
+	render_context render;
 } compositor;
 
+/* wl_buffer as seen by the compositor */
+typedef struct compositor_buffer {
+	struct wl_resource *resource; /* NULL once destroyed by the client */
+	struct wl_listener destroy_listener;
+	int busy_count; /* commits still referring to the buffer */
+
+	/* GPU and imported shm buffers: created once, kept until destroyed */
+	EGLImageKHR egl_image;
+	int32_t width;
+	int32_t height;
+	/* display import on the render thread, see winsys_dmabuf */
+	compositor *scanout_compositor;
+	uint64_t scanout_id; /* 0 until offered for scanout */
+
+	/* zero-copy shm import and plane checks, see shm_import.c */
+	struct shm_import_pool *import_pool;
+	int32_t import_offset;
+	bool import_checked;
+	bool import_failed; /* no EGLImage, GPU buffers too: not retried */
+	bool layout_rejected; /* planes exceed the pool, warned once */
+} compositor_buffer;
+
+/* wl_buffer created through zwp_linux_buffer_params_v1, see linux_dmabuf.c */
+typedef struct linux_dmabuf_buffer {
+	struct wl_resource *resource;
+	int32_t width;
+	int32_t height;
+	uint32_t format; /* DRM fourcc */
+	uint32_t flags; /* zwp_linux_buffer_params_v1 flags, not applied */
+	int plane_num;
+	struct {
+		int fd; /* -1 while not added */
+		uint32_t offset;
+		uint32_t stride;
+		uint64_t modifier;
+	} planes[DMABUF_PLANE_MAX];
+} linux_dmabuf_buffer;
+
 /* wl_compositor_create_surface() */
 typedef struct compositor_surface {
 	struct wl_resource *resource;
@@ -82,22 +283,105 @@ typedef struct compositor_surface {
 	compositor *compositor;
 	struct shell_surface *shell_surface;
 	struct wl_list pending_frame_callback_list;
-	struct wl_list frame_callback_list;
-
-	struct wl_resource *wl_buffer;
-	struct wl_resource *wl_used_buffer;
-	EGLImageKHR eglImg;
-	GLuint texid[2];
-	int status[2];
-	GLsync glsyncobj_tex;
-	int current_tex_index;
-	int updated_tex_index;
+	struct wl_list pending_feedback_list; /* wp_presentation_feedback */
+	struct wl_resource *pending_buffer;
+	struct wl_listener pending_buffer_destroy_listener;
+	damage pending_damage; /* surface coordinates */
+	damage pending_buffer_damage;
+	int32_t pending_buffer_scale;
+	int32_t pending_buffer_transform;
+	int32_t buffer_scale;
+	int32_t buffer_transform;
 	int img_w; /* shm_buffer width      */
 	int img_h; /* shm_buffer height     */
 	bool pointer_focused;
 	bool keyboard_focused;
+	struct linux_drm_syncobj_surface *syncobj; /* explicit sync */
+	struct wl_list acquire_list; /* commits waiting for an acquire point */
+	struct wl_list acquire_link; /* surfaces with commits waiting */
+
+	/* owned by the render thread */
+	int draw_index; /* in render_context draws, -1 while unmapped */
+	struct render_commit *pending; /* mailbox: newest commit not uploaded */
+	tex_slot slots[TEX_SLOT_MAX];
+	int slot_num;
+	int displayed_slot; /* -1 until the first upload completed */
+	uint32_t upload_seq;
+	tile_grid tiles; /* content of the last shm upload */
 } compositor_surface;
 
+typedef enum {
+	RENDER_COMMIT_BUFFER,
+	RENDER_COMMIT_MAP,
+	RENDER_COMMIT_DESTROY,
+	RENDER_COMMIT_FORGET, /* scanout.id of a destroyed buffer */
+	RENDER_COMMIT_QUIT,
+} render_commit_type;
+
+/*
+ * Immutable snapshot of a wl_surface.commit, handed over to the render
+ * thread. The buffer content is described without any wl_resource so
+ * that the render thread never touches protocol objects.
+ */
+typedef struct render_commit {
+	render_queue_node node;
+	render_commit_type type;
+	compositor_surface *csfc;
+	/* set when replaced by a newer commit of the surface */
+	struct render_commit *superseded_by;
+
+	struct wl_shm_pool *shm_pool; /* keeps the shm mapping alive */
+	struct wl_shm_buffer *shm_buffer; /* SIGBUS guard of the copy workers */
+	void *shm_data;
+	int32_t shm_stride;
+	uint32_t shm_format;
+	EGLImageKHR egl_image;
+	bool egl_image_cached; /* owned by the buffer, not destroyed on retire */
+	int32_t width;
+	int32_t height;
+	damage damage; /* buffer coordinates, relative to the last commit */
+	uint32_t timeline_id;
+	/* dmabuf, plane_num is 0 unless it may be scanned out */
+	winsys_dmabuf scanout;
+	bool scanout_fullscreen; /* may replace the composited frame */
+	/* explicit sync, see linux_drm_syncobj.c */
+	linux_drm_syncobj_point acquire_point;
+	linux_drm_syncobj_point release_point;
+	int acquire_fd; /* sync_file of the acquire point, -1 without */
+	struct wl_list acquire_link; /* compositor_surface acquire_list */
+
+	/* shm content copied by the copy pool */
+	bool copying; /* set on submit, cleared by the render thread */
+	void *staging;
+	size_t staging_size;
+	int32_t staging_stride;
+	uint32_t staging_format; /* differs when converted while copying */
+	struct render_commit *copy_next; /* copy pool job list */
+	render_queue_node copy_node;
+
+	/* owned by the render thread */
+	struct wl_list done_link; /* render_context done lists */
+	struct wl_list present_link; /* render_context present_list */
+	bool retire_deferred; /* retired before its frame was flipped */
+	bool scanout_busy; /* flipped to, held until it leaves the screen */
+
+	/* presentation of the first frame showing the commit */
+	uint64_t present_nsec; /* CLOCK_MONOTONIC */
+	uint64_t present_seq;
+	uint32_t present_refresh_nsec;
+	uint32_t present_flags; /* wp_presentation_feedback_kind */
+
+	/* owned by the dispatch thread */
+	bool has_buffer; /* a buffer was attached */
+	compositor_buffer *buffer; /* NULL once released */
+	struct wl_list frame_callback_list;
+	struct wl_list feedback_list; /* wp_presentation_feedback */
+
+	render_event release;
+	render_event supersede;
+	render_event retire;
+} render_commit;
+
 typedef struct compositor_region {
 	struct wl_resource *resource;
 } compositor_region;
@@ -142,6 +426,96 @@ typedef struct compositor_frame_callback {
 
 void compositor_seat_init(compositor *compositor);
 
+uint64_t get_monotonic_nsec(void);
+int repaint_scheduler_init(compositor *compositor, struct wl_event_loop *loop,
+			   int window_msec);
+void repaint_schedule(compositor *compositor);
+void repaint_finished(compositor *compositor, uint64_t composite_nsec);
+
+/* convert a row of width pixels into ARGB8888 */
+typedef void (*pixel_convert_func)(uint8_t *dst, const uint8_t *src,
+				   int32_t width);
+
+typedef struct pixel_converter {
+	uint32_t shm_format;
+	int bpp; /* source bytes per pixel */
+	pixel_convert_func convert;
+} pixel_converter;
+
+void pixel_convert_init(void);
+const pixel_converter *pixel_convert_lookup(uint32_t shm_format);
+void pixel_convert_add_shm_formats(struct wl_display *display);
+void pixel_convert_bench(void);
+
+int copy_pool_init(compositor *compositor, int worker_num, bool prefetch);
+bool copy_pool_active(void);
+void copy_pool_submit(render_commit *rc);
+void copy_pool_stop(void);
+void copy_pool_put_staging(void *staging, size_t size);
+
+int linux_dmabuf_init(compositor *compositor, struct wl_display *display);
+void linux_dmabuf_release(void);
+linux_dmabuf_buffer *linux_dmabuf_buffer_get(struct wl_resource *resource);
+EGLImageKHR linux_dmabuf_buffer_import(compositor *compositor,
+				       const linux_dmabuf_buffer *buffer);
+
+int linux_drm_syncobj_init(compositor *compositor, struct wl_display *display,
+			   bool enable);
+void linux_drm_syncobj_release(void);
+int linux_drm_syncobj_surface_check(compositor_surface *csfc);
+void linux_drm_syncobj_commit_points(render_commit *rc);
+void linux_drm_syncobj_submit(compositor *compositor, render_commit *rc);
+void linux_drm_syncobj_surface_destroy(compositor_surface *csfc);
+void linux_drm_syncobj_commit_free(render_commit *rc);
+void linux_drm_syncobj_signal(const linux_drm_syncobj_point *point,
+			      int fence_fd);
+
+void tile_hash_init(void);
+void tile_grid_reset(tile_grid *grid);
+void tile_grid_release(tile_grid *grid);
+bool tile_grid_refine(tile_grid *grid, const uint8_t *data, int32_t stride,
+		      int32_t bpp, uint32_t format, int32_t width,
+		      int32_t height, damage *dmg);
+
+int shm_import_init(compositor *compositor, struct wl_display *display,
+		    bool enable);
+EGLImageKHR shm_import_image(compositor *compositor, compositor_buffer *buffer,
+			     struct wl_shm_buffer *shm_buf);
+bool shm_import_buffer_fits(compositor_buffer *buffer,
+			    struct wl_shm_buffer *shm_buf);
+void shm_import_buffer_release(compositor_buffer *buffer);
+
+void damage_init(damage *d);
+void damage_set_full(damage *d);
+bool damage_is_empty(const damage *d);
+void damage_add(damage *d, int32_t x, int32_t y, int32_t w, int32_t h);
+void damage_union(damage *d, const damage *src);
+void damage_clip(damage *d, int32_t width, int32_t height);
+
+uint32_t timeline_begin(uint32_t surface_id, uint32_t client_pid);
+void timeline_stamp(uint32_t id, timeline_stage stage);
+void timeline_frame_begin(void);
+void timeline_frame_add(uint32_t id);
+void timeline_frame_stamp(timeline_stage stage);
+void timeline_dump(void);
+
+int render_init(compositor *compositor, bool vsync, int repaint_window_msec,
+		int tex_slot_num, bool pbo_upload);
+void render_surface_init(compositor_surface *csfc);
+int render_start(compositor *compositor);
+void render_stop(compositor *compositor);
+bool render_shm_format_native(uint32_t shm_format);
+size_t render_shm_buffer_size(uint32_t shm_format, int32_t stride,
+			      int32_t height);
+void render_add_shm_formats(struct wl_display *display);
+render_commit *render_commit_create(render_commit_type type,
+				    compositor_surface *csfc);
+void render_commit_free(render_commit *rc);
+void render_submit(compositor *compositor, render_commit *rc);
+void render_scanout_flipped(compositor *compositor);
+void render_frame_presented(compositor *compositor, uint64_t nsec,
+			    uint64_t seq, uint32_t flags);
+
 #define UNUSED(x) (void)(x)
 
 #endif /* COMPOSITOR_H_ */
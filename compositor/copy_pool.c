@@ -0,0 +1,305 @@
+// SPDX-License-Identifier: Apache-2.0
+/**
+ * Copyright (c) 2024  Panasonic Automotive Systems, Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Worker threads copying committed shm content into compositor-owned
+ * staging memory. Once a copy is done the client buffer is released right
+ * away, and the render thread uploads from the staging copy. Clients can
+ * therefore reuse a single buffer without waiting for the upload fence.
+ *
+ * Without copy workers a single prefetch worker can take their place: it
+ * only faults the committed pages in, so that the upload reading client
+ * memory does not stall the render thread on page faults. The pages are
+ * not pinned, the client may still truncate its pool before the upload,
+ * which therefore reads under the SIGBUS guard of the render thread.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <wayland-server.h>
+#include "util_egl.h"
+#include "util_log.h"
+#include "compositor.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define COPY_WORKER_MAX 8
+#define STAGING_CACHE_MAX 8
+#define STAGING_ALIGN 64
+
+static compositor *s_compositor = NULL;
+static pthread_t s_workers[COPY_WORKER_MAX];
+static int s_worker_num = 0;
+static bool s_prefetch_only = false;
+static size_t s_page_size = 4096;
+
+/* job list, FIFO */
+static pthread_mutex_t s_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_cond = PTHREAD_COND_INITIALIZER;
+static render_commit *s_head = NULL;
+static render_commit *s_tail = NULL;
+static bool s_quit = false;
+
+/* staging buffers of recently freed commits, reused at the same size */
+static struct {
+	void *data;
+	size_t size;
+} s_staging_cache[STAGING_CACHE_MAX];
+static int s_staging_num = 0;
+
+/*
+ * The staging copy is only read back by the GL upload, keep it out of the
+ * caches with non-temporal stores.
+ */
+static void copy_stream(void *dst, const void *src, size_t size)
+{
+#ifdef __SSE2__
+	uint8_t *d = dst;
+	const uint8_t *s = src;
+	size_t n = size & ~(size_t)63;
+
+	for (size_t i = 0; i < n; i += 64) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(s + i));
+		__m128i b = _mm_loadu_si128((const __m128i *)(s + i + 16));
+		__m128i c = _mm_loadu_si128((const __m128i *)(s + i + 32));
+		__m128i e = _mm_loadu_si128((const __m128i *)(s + i + 48));
+		_mm_stream_si128((__m128i *)(d + i), a);
+		_mm_stream_si128((__m128i *)(d + i + 16), b);
+		_mm_stream_si128((__m128i *)(d + i + 32), c);
+		_mm_stream_si128((__m128i *)(d + i + 48), e);
+	}
+	memcpy(d + n, s + n, size - n);
+	_mm_sfence();
+#else
+	memcpy(dst, src, size);
+#endif
+}
+
+static void *copy_pool_get_staging(size_t size)
+{
+	void *data = NULL;
+
+	pthread_mutex_lock(&s_mutex);
+	for (int i = 0; i < s_staging_num; i++) {
+		if (s_staging_cache[i].size == size) {
+			data = s_staging_cache[i].data;
+			s_staging_cache[i] = s_staging_cache[--s_staging_num];
+			break;
+		}
+	}
+	pthread_mutex_unlock(&s_mutex);
+
+	if (data == NULL) {
+		size_t alloc = (size + STAGING_ALIGN - 1) &
+			       ~(size_t)(STAGING_ALIGN - 1);
+		data = aligned_alloc(STAGING_ALIGN, alloc);
+	}
+	return data;
+}
+
+void copy_pool_put_staging(void *staging, size_t size)
+{
+	void *evicted = NULL;
+
+	pthread_mutex_lock(&s_mutex);
+	if (s_staging_num == STAGING_CACHE_MAX) {
+		evicted = s_staging_cache[0].data;
+		s_staging_cache[0] = s_staging_cache[--s_staging_num];
+	}
+	s_staging_cache[s_staging_num].data = staging;
+	s_staging_cache[s_staging_num].size = size;
+	s_staging_num++;
+	pthread_mutex_unlock(&s_mutex);
+
+	free(evicted);
+}
+
+/*
+ * Map the shm pages of the commit into the compositor. MADV_POPULATE_READ
+ * fails on pages beyond a truncated pool instead of raising SIGBUS, older
+ * kernels get their pages read-touched after a readahead hint, under the
+ * SIGBUS guard of the worker.
+ */
+static void copy_prefetch(const render_commit *rc)
+{
+	size_t size = render_shm_buffer_size(rc->shm_format, rc->shm_stride,
+					     rc->height);
+	uintptr_t start = (uintptr_t)rc->shm_data & ~(s_page_size - 1);
+	uintptr_t end = (uintptr_t)rc->shm_data + size;
+
+#ifdef MADV_POPULATE_READ
+	if (madvise((void *)start, end - start, MADV_POPULATE_READ) == 0 ||
+	    errno != EINVAL)
+		return;
+#endif
+	madvise((void *)start, end - start, MADV_WILLNEED);
+	const volatile uint8_t *data = rc->shm_data;
+	wl_shm_buffer_begin_access(rc->shm_buffer);
+	for (size_t off = 0; off < size; off += s_page_size)
+		(void)data[off];
+	if (size > 0)
+		(void)data[size - 1];
+	wl_shm_buffer_end_access(rc->shm_buffer);
+}
+
+/* formats GL cannot sample are converted on the way */
+static void copy_convert(render_commit *rc, const pixel_converter *conv)
+{
+	uint8_t *dst = rc->staging;
+	const uint8_t *src = rc->shm_data;
+
+	for (int32_t y = 0; y < rc->height; y++)
+		conv->convert(dst + (size_t)y * rc->staging_stride,
+			      src + (size_t)y * rc->shm_stride, rc->width);
+}
+
+/*
+ * The release event is queued before the commit is handed back to the
+ * render thread: the commit cannot be retired, and freed, before the
+ * dispatch thread has released the buffer. A client truncating its pool
+ * meanwhile gets the pages zero-filled by the SIGBUS guard, which is per
+ * thread and so taken on the worker.
+ */
+static void copy_commit(render_commit *rc)
+{
+	render_context *render = &s_compositor->render;
+	const pixel_converter *conv =
+		render_shm_format_native(rc->shm_format) ?
+			NULL :
+			pixel_convert_lookup(rc->shm_format);
+	int32_t stride = conv ? rc->width * 4 : rc->shm_stride;
+	size_t size = conv ? (size_t)stride * rc->height :
+			     render_shm_buffer_size(rc->shm_format, stride,
+						    rc->height);
+
+	rc->staging = copy_pool_get_staging(size);
+	if (rc->staging) {
+		rc->staging_size = size;
+		rc->staging_stride = stride;
+		wl_shm_buffer_begin_access(rc->shm_buffer);
+		if (conv) {
+			rc->staging_format = WL_SHM_FORMAT_ARGB8888;
+			copy_convert(rc, conv);
+		} else {
+			rc->staging_format = rc->shm_format;
+			copy_stream(rc->staging, rc->shm_data, size);
+		}
+		wl_shm_buffer_end_access(rc->shm_buffer);
+		timeline_stamp(rc->timeline_id, TIMELINE_COPY);
+		render_queue_push(&render->event_queue, &rc->release.node);
+	} else {
+		ELOG("%s\n", __FUNCTION__);
+	}
+	render_queue_push(&render->copy_queue, &rc->copy_node);
+}
+
+static void *copy_worker_main(void *data)
+{
+	for (;;) {
+		pthread_mutex_lock(&s_mutex);
+		while (s_head == NULL && !s_quit)
+			pthread_cond_wait(&s_cond, &s_mutex);
+		if (s_quit) {
+			pthread_mutex_unlock(&s_mutex);
+			break;
+		}
+		render_commit *rc = s_head;
+		s_head = rc->copy_next;
+		if (s_head == NULL)
+			s_tail = NULL;
+		pthread_mutex_unlock(&s_mutex);
+
+		if (s_prefetch_only) {
+			copy_prefetch(rc);
+			timeline_stamp(rc->timeline_id, TIMELINE_COPY);
+			render_queue_push(&s_compositor->render.copy_queue,
+					  &rc->copy_node);
+		} else {
+			copy_commit(rc);
+		}
+	}
+	return NULL;
+}
+
+int copy_pool_init(compositor *compositor, int worker_num, bool prefetch)
+{
+	s_compositor = compositor;
+	s_page_size = sysconf(_SC_PAGESIZE);
+	if (worker_num > COPY_WORKER_MAX)
+		worker_num = COPY_WORKER_MAX;
+	if (worker_num == 0 && prefetch) {
+		s_prefetch_only = true;
+		worker_num = 1;
+	}
+
+	for (int i = 0; i < worker_num; i++) {
+		int ret = pthread_create(&s_workers[i], NULL, copy_worker_main,
+					 NULL);
+		if (ret != 0) {
+			ELOG("%s pthread_create: %s\n", __FUNCTION__,
+			     strerror(ret));
+			break;
+		}
+		s_worker_num++;
+	}
+	if (s_prefetch_only)
+		ILOG("shm prefetch workers: %d\n", s_worker_num);
+	else
+		ILOG("shm copy workers: %d\n", s_worker_num);
+	return 0;
+}
+
+bool copy_pool_active(void)
+{
+	return s_worker_num > 0;
+}
+
+/* dispatch thread, while the shm pool of the commit is referenced */
+void copy_pool_submit(render_commit *rc)
+{
+	rc->copying = true;
+	rc->copy_next = NULL;
+
+	pthread_mutex_lock(&s_mutex);
+	if (s_tail)
+		s_tail->copy_next = rc;
+	else
+		s_head = rc;
+	s_tail = rc;
+	pthread_cond_signal(&s_cond);
+	pthread_mutex_unlock(&s_mutex);
+}
+
+/* pending jobs are dropped, the render thread is stopped right after */
+void copy_pool_stop(void)
+{
+	pthread_mutex_lock(&s_mutex);
+	s_quit = true;
+	pthread_cond_broadcast(&s_cond);
+	pthread_mutex_unlock(&s_mutex);
+
+	for (int i = 0; i < s_worker_num; i++)
+		pthread_join(s_workers[i], NULL);
+	s_worker_num = 0;
+}
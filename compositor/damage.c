@@ -0,0 +1,145 @@
+// SPDX-License-Identifier: Apache-2.0
+/**
+ * Copyright (c) 2024  Panasonic Automotive Systems, Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Damage is kept as a short list of rectangles in buffer coordinates.
+ * Rectangles are merged whenever their bounding box costs no more than
+ * uploading both, and the list degrades into coarser bounding boxes once
+ * it is full, so a damage never grows beyond DAMAGE_RECT_MAX uploads.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <wayland-server.h>
+#include "util_egl.h"
+#include "compositor.h"
+
+static int64_t rect_area(const damage_rect *r)
+{
+	return (int64_t)r->w * r->h;
+}
+
+static damage_rect rect_union(const damage_rect *a, const damage_rect *b)
+{
+	int32_t x1 = a->x < b->x ? a->x : b->x;
+	int32_t y1 = a->y < b->y ? a->y : b->y;
+	int32_t x2 = a->x + a->w > b->x + b->w ? a->x + a->w : b->x + b->w;
+	int32_t y2 = a->y + a->h > b->y + b->h ? a->y + a->h : b->y + b->h;
+	damage_rect r = { x1, y1, x2 - x1, y2 - y1 };
+
+	return r;
+}
+
+void damage_init(damage *d)
+{
+	d->full = false;
+	d->num = 0;
+}
+
+void damage_set_full(damage *d)
+{
+	d->full = true;
+	d->num = 0;
+}
+
+bool damage_is_empty(const damage *d)
+{
+	return !d->full && d->num == 0;
+}
+
+void damage_add(damage *d, int32_t x, int32_t y, int32_t w, int32_t h)
+{
+	damage_rect r;
+	/* edges in 64 bits, clamped to [0, INT32_MAX]: clients pass anything */
+	int64_t x1 = x, y1 = y;
+	int64_t x2 = x1 + w, y2 = y1 + h;
+
+	if (x1 < 0)
+		x1 = 0;
+	if (y1 < 0)
+		y1 = 0;
+	if (x2 > INT32_MAX)
+		x2 = INT32_MAX;
+	if (y2 > INT32_MAX)
+		y2 = INT32_MAX;
+	if (d->full || x2 <= x1 || y2 <= y1)
+		return;
+	r.x = x1;
+	r.y = y1;
+	r.w = x2 - x1;
+	r.h = y2 - y1;
+
+	for (;;) {
+		int best = -1;
+		int64_t best_cost = INT64_MAX;
+
+		for (int i = 0; i < d->num; i++) {
+			damage_rect u = rect_union(&d->rects[i], &r);
+			int64_t cost = rect_area(&u) - rect_area(&d->rects[i]) -
+				       rect_area(&r);
+			if (cost < best_cost) {
+				best = i;
+				best_cost = cost;
+			}
+		}
+		/* merge for free, or because there is no room left */
+		if (best < 0 || (best_cost > 0 && d->num < DAMAGE_RECT_MAX))
+			break;
+		r = rect_union(&d->rects[best], &r);
+		d->rects[best] = d->rects[--d->num];
+	}
+	d->rects[d->num++] = r;
+}
+
+void damage_union(damage *d, const damage *src)
+{
+	if (src->full) {
+		damage_set_full(d);
+		return;
+	}
+	for (int i = 0; i < src->num; i++)
+		damage_add(d, src->rects[i].x, src->rects[i].y,
+			   src->rects[i].w, src->rects[i].h);
+}
+
+/* restrict to the buffer, a damage covering all of it becomes full */
+void damage_clip(damage *d, int32_t width, int32_t height)
+{
+	int num = 0;
+
+	if (d->full)
+		return;
+
+	for (int i = 0; i < d->num; i++) {
+		damage_rect r = d->rects[i];
+		int32_t x2 = r.x + r.w < width ? r.x + r.w : width;
+		int32_t y2 = r.y + r.h < height ? r.y + r.h : height;
+
+		r.x = r.x > 0 ? r.x : 0;
+		r.y = r.y > 0 ? r.y : 0;
+		r.w = x2 - r.x;
+		r.h = y2 - r.y;
+		if (r.w <= 0 || r.h <= 0)
+			continue;
+		if (r.w == width && r.h == height) {
+			damage_set_full(d);
+			return;
+		}
+		d->rects[num++] = r;
+	}
+	d->num = num;
+}
@@ -0,0 +1,552 @@
+// SPDX-License-Identifier: Apache-2.0
+/**
+ * Copyright (c) 2024  Panasonic Automotive Systems, Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * zwp_linux_dmabuf_v1, version 3. The formats and modifiers EGL can
+ * import are queried once and announced to every client; the dmabufs of
+ * a wl_buffer are imported as an EGLImage when it is committed, like the
+ * buffers of EGL_WL_bind_wayland_display.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <wayland-server.h>
+#include <linux-dmabuf-unstable-v1-server-protocol.h>
+#include "util_egl.h"
+#include "util_log.h"
+#include "compositor.h"
+
+#define DRM_FORMAT_MOD_INVALID 0x00ffffffffffffffULL
+
+#define FOURCC(a, b, c, d)                                                     \
+	((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) |        \
+	 ((uint32_t)(d) << 24))
+
+typedef struct dmabuf_format {
+	uint32_t format;
+	int modifier_num;
+	uint64_t *modifiers;
+} dmabuf_format;
+
+static PFNEGLCREATEIMAGEKHRPROC eglCreateImageKHR;
+static PFNEGLDESTROYIMAGEKHRPROC eglDestroyImageKHR;
+static PFNEGLQUERYDMABUFFORMATSEXTPROC eglQueryDmaBufFormatsEXT;
+static PFNEGLQUERYDMABUFMODIFIERSEXTPROC eglQueryDmaBufModifiersEXT;
+
+static compositor *s_compositor = NULL;
+static dmabuf_format *s_formats = NULL;
+static int s_format_num = 0;
+static bool s_modifiers = false; /* EGL_EXT_image_dma_buf_import_modifiers */
+
+/* without EGL_EXT_image_dma_buf_import_modifiers */
+static const uint32_t s_default_formats[] = {
+	FOURCC('A', 'R', '2', '4'), /* DRM_FORMAT_ARGB8888 */
+	FOURCC('X', 'R', '2', '4'), /* DRM_FORMAT_XRGB8888 */
+	FOURCC('A', 'B', '2', '4'), /* DRM_FORMAT_ABGR8888 */
+	FOURCC('X', 'B', '2', '4'), /* DRM_FORMAT_XBGR8888 */
+};
+
+static const EGLint s_plane_attribs[DMABUF_PLANE_MAX][5] = {
+	{ EGL_DMA_BUF_PLANE0_FD_EXT, EGL_DMA_BUF_PLANE0_OFFSET_EXT,
+	  EGL_DMA_BUF_PLANE0_PITCH_EXT, EGL_DMA_BUF_PLANE0_MODIFIER_LO_EXT,
+	  EGL_DMA_BUF_PLANE0_MODIFIER_HI_EXT },
+	{ EGL_DMA_BUF_PLANE1_FD_EXT, EGL_DMA_BUF_PLANE1_OFFSET_EXT,
+	  EGL_DMA_BUF_PLANE1_PITCH_EXT, EGL_DMA_BUF_PLANE1_MODIFIER_LO_EXT,
+	  EGL_DMA_BUF_PLANE1_MODIFIER_HI_EXT },
+	{ EGL_DMA_BUF_PLANE2_FD_EXT, EGL_DMA_BUF_PLANE2_OFFSET_EXT,
+	  EGL_DMA_BUF_PLANE2_PITCH_EXT, EGL_DMA_BUF_PLANE2_MODIFIER_LO_EXT,
+	  EGL_DMA_BUF_PLANE2_MODIFIER_HI_EXT },
+	{ EGL_DMA_BUF_PLANE3_FD_EXT, EGL_DMA_BUF_PLANE3_OFFSET_EXT,
+	  EGL_DMA_BUF_PLANE3_PITCH_EXT, EGL_DMA_BUF_PLANE3_MODIFIER_LO_EXT,
+	  EGL_DMA_BUF_PLANE3_MODIFIER_HI_EXT },
+};
+
+/*--------------------------------------------------------------------------- *
+ *  wl_buffer
+ *--------------------------------------------------------------------------- */
+static void linux_dmabuf_buffer_free(linux_dmabuf_buffer *buffer)
+{
+	for (int i = 0; i < DMABUF_PLANE_MAX; i++) {
+		if (buffer->planes[i].fd >= 0)
+			close(buffer->planes[i].fd);
+	}
+	free(buffer);
+}
+
+static void dmabuf_buffer_destroy(struct wl_client *client,
+				  struct wl_resource *resource)
+{
+	DLOG("%s\n", __FUNCTION__);
+	wl_resource_destroy(resource);
+}
+
+static const struct wl_buffer_interface dmabuf_buffer_interface = {
+	dmabuf_buffer_destroy,
+};
+
+static void dmabuf_buffer_resource_destroy(struct wl_resource *resource)
+{
+	linux_dmabuf_buffer_free(wl_resource_get_user_data(resource));
+}
+
+linux_dmabuf_buffer *linux_dmabuf_buffer_get(struct wl_resource *resource)
+{
+	if (resource == NULL ||
+	    !wl_resource_instance_of(resource, &wl_buffer_interface,
+				     &dmabuf_buffer_interface))
+		return NULL;
+	return wl_resource_get_user_data(resource);
+}
+
+/* may be called without a current context */
+EGLImageKHR linux_dmabuf_buffer_import(compositor *compositor,
+				       const linux_dmabuf_buffer *buffer)
+{
+	EGLint attribs[6 + DMABUF_PLANE_MAX * 10 + 1];
+	int n = 0;
+
+	attribs[n++] = EGL_WIDTH;
+	attribs[n++] = buffer->width;
+	attribs[n++] = EGL_HEIGHT;
+	attribs[n++] = buffer->height;
+	attribs[n++] = EGL_LINUX_DRM_FOURCC_EXT;
+	attribs[n++] = buffer->format;
+	for (int i = 0; i < buffer->plane_num; i++) {
+		const EGLint *a = s_plane_attribs[i];
+		uint64_t modifier = buffer->planes[i].modifier;
+
+		attribs[n++] = a[0];
+		attribs[n++] = buffer->planes[i].fd;
+		attribs[n++] = a[1];
+		attribs[n++] = buffer->planes[i].offset;
+		attribs[n++] = a[2];
+		attribs[n++] = buffer->planes[i].stride;
+		if (s_modifiers && modifier != DRM_FORMAT_MOD_INVALID) {
+			attribs[n++] = a[3];
+			attribs[n++] = modifier & 0xffffffff;
+			attribs[n++] = a[4];
+			attribs[n++] = modifier >> 32;
+		}
+	}
+	attribs[n++] = EGL_NONE;
+
+	return eglCreateImageKHR(compositor->egl_display, EGL_NO_CONTEXT,
+				 EGL_LINUX_DMA_BUF_EXT, NULL, attribs);
+}
+
+/*--------------------------------------------------------------------------- *
+ *  zwp_linux_buffer_params_v1
+ *--------------------------------------------------------------------------- */
+static void params_destroy(struct wl_client *client,
+			   struct wl_resource *resource)
+{
+	DLOG("%s\n", __FUNCTION__);
+	wl_resource_destroy(resource);
+}
+
+static void params_resource_destroy(struct wl_resource *resource)
+{
+	linux_dmabuf_buffer *buffer = wl_resource_get_user_data(resource);
+
+	if (buffer)
+		linux_dmabuf_buffer_free(buffer);
+}
+
+static void params_add(struct wl_client *client, struct wl_resource *resource,
+		       int32_t fd, uint32_t plane_idx, uint32_t offset,
+		       uint32_t stride, uint32_t modifier_hi,
+		       uint32_t modifier_lo)
+{
+	DLOG("%s\n", __FUNCTION__);
+	linux_dmabuf_buffer *buffer = wl_resource_get_user_data(resource);
+
+	if (buffer == NULL) {
+		wl_resource_post_error(resource,
+				       ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_ALREADY_USED,
+				       "params was already used to create a wl_buffer");
+		close(fd);
+		return;
+	}
+	if (plane_idx >= DMABUF_PLANE_MAX) {
+		wl_resource_post_error(resource,
+				       ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_PLANE_IDX,
+				       "plane index %u is too high", plane_idx);
+		close(fd);
+		return;
+	}
+	if (buffer->planes[plane_idx].fd >= 0) {
+		wl_resource_post_error(resource,
+				       ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_PLANE_SET,
+				       "a dmabuf was already set for plane %u",
+				       plane_idx);
+		close(fd);
+		return;
+	}
+	buffer->planes[plane_idx].fd = fd;
+	buffer->planes[plane_idx].offset = offset;
+	buffer->planes[plane_idx].stride = stride;
+	buffer->planes[plane_idx].modifier =
+		((uint64_t)modifier_hi << 32) | modifier_lo;
+}
+
+static bool dmabuf_format_supported(uint32_t format)
+{
+	for (int i = 0; i < s_format_num; i++) {
+		if (s_formats[i].format == format)
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Argument errors are fatal. A failed import is reported by 'failed' for
+ * create and as a fatal error for create_immed. Returns the new wl_buffer.
+ */
+static struct wl_resource *params_create_common(struct wl_client *client,
+						struct wl_resource *resource,
+						uint32_t buffer_id,
+						int32_t width, int32_t height,
+						uint32_t format, uint32_t flags)
+{
+	linux_dmabuf_buffer *buffer = wl_resource_get_user_data(resource);
+	int plane_num = 0;
+
+	if (buffer == NULL) {
+		wl_resource_post_error(resource,
+				       ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_ALREADY_USED,
+				       "params was already used to create a wl_buffer");
+		return NULL;
+	}
+	wl_resource_set_user_data(resource, NULL);
+
+	/* planes 0 to plane_num - 1, without gaps */
+	while (plane_num < DMABUF_PLANE_MAX &&
+	       buffer->planes[plane_num].fd >= 0)
+		plane_num++;
+	for (int i = plane_num; i < DMABUF_PLANE_MAX; i++) {
+		if (buffer->planes[i].fd >= 0)
+			plane_num = 0;
+	}
+	if (plane_num == 0) {
+		wl_resource_post_error(resource,
+				       ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INCOMPLETE,
+				       "planes are missing");
+		goto err;
+	}
+	if (width <= 0 || height <= 0) {
+		wl_resource_post_error(resource,
+				       ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INVALID_DIMENSIONS,
+				       "invalid size %dx%d", width, height);
+		goto err;
+	}
+	if (!dmabuf_format_supported(format)) {
+		wl_resource_post_error(resource,
+				       ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INVALID_FORMAT,
+				       "format 0x%08x is not supported", format);
+		goto err;
+	}
+	for (int i = 0; i < plane_num; i++) {
+		off_t size = lseek(buffer->planes[i].fd, 0, SEEK_END);
+		uint64_t end = buffer->planes[i].offset;
+
+		/* not every exporter reports a size */
+		if (size == -1)
+			continue;
+		if (i == 0)
+			end += (uint64_t)buffer->planes[i].stride * height;
+		if (buffer->planes[i].offset >= size || end > (uint64_t)size) {
+			wl_resource_post_error(resource,
+					       ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_OUT_OF_BOUNDS,
+					       "plane %d is out of bounds", i);
+			goto err;
+		}
+	}
+	buffer->width = width;
+	buffer->height = height;
+	buffer->format = format;
+	buffer->flags = flags;
+	buffer->plane_num = plane_num;
+
+	/* find out now whether EGL takes the dmabufs */
+	EGLImageKHR image = linux_dmabuf_buffer_import(s_compositor, buffer);
+	if (image == EGL_NO_IMAGE_KHR) {
+		WLOG("%s eglCreateImageKHR: 0x%x\n", __FUNCTION__,
+		     eglGetError());
+		if (buffer_id == 0)
+			zwp_linux_buffer_params_v1_send_failed(resource);
+		else
+			wl_resource_post_error(resource,
+					       ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INVALID_WL_BUFFER,
+					       "importing the dmabufs failed");
+		goto err;
+	}
+	eglDestroyImageKHR(s_compositor->egl_display, image);
+
+	buffer->resource =
+		wl_resource_create(client, &wl_buffer_interface, 1, buffer_id);
+	if (buffer->resource == NULL) {
+		wl_client_post_no_memory(client);
+		goto err;
+	}
+	wl_resource_set_implementation(buffer->resource,
+				       &dmabuf_buffer_interface, buffer,
+				       dmabuf_buffer_resource_destroy);
+	return buffer->resource;
+
+err:
+	linux_dmabuf_buffer_free(buffer);
+	return NULL;
+}
+
+static void params_create(struct wl_client *client,
+			  struct wl_resource *resource, int32_t width,
+			  int32_t height, uint32_t format, uint32_t flags)
+{
+	DLOG("%s\n", __FUNCTION__);
+	struct wl_resource *buffer = params_create_common(
+		client, resource, 0, width, height, format, flags);
+
+	if (buffer)
+		zwp_linux_buffer_params_v1_send_created(resource, buffer);
+}
+
+static void params_create_immed(struct wl_client *client,
+				struct wl_resource *resource,
+				uint32_t buffer_id, int32_t width,
+				int32_t height, uint32_t format, uint32_t flags)
+{
+	DLOG("%s\n", __FUNCTION__);
+	params_create_common(client, resource, buffer_id, width, height,
+			     format, flags);
+}
+
+static const struct zwp_linux_buffer_params_v1_interface params_interface = {
+	params_destroy,
+	params_add,
+	params_create,
+	params_create_immed,
+};
+
+/*--------------------------------------------------------------------------- *
+ *  zwp_linux_dmabuf_v1
+ *--------------------------------------------------------------------------- */
+static void linux_dmabuf_destroy(struct wl_client *client,
+				 struct wl_resource *resource)
+{
+	DLOG("%s\n", __FUNCTION__);
+	wl_resource_destroy(resource);
+}
+
+static void linux_dmabuf_create_params(struct wl_client *client,
+				       struct wl_resource *resource,
+				       uint32_t params_id)
+{
+	DLOG("%s\n", __FUNCTION__);
+	linux_dmabuf_buffer *buffer = calloc(sizeof(*buffer), 1);
+	struct wl_resource *params;
+
+	if (buffer == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	for (int i = 0; i < DMABUF_PLANE_MAX; i++)
+		buffer->planes[i].fd = -1;
+
+	params = wl_resource_create(client,
+				    &zwp_linux_buffer_params_v1_interface,
+				    wl_resource_get_version(resource),
+				    params_id);
+	if (params == NULL) {
+		free(buffer);
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(params, &params_interface, buffer,
+				       params_resource_destroy);
+}
+
+static const struct zwp_linux_dmabuf_v1_interface linux_dmabuf_interface = {
+	linux_dmabuf_destroy,
+	linux_dmabuf_create_params,
+};
+
+/* version 3 announces modifiers, older clients only get the formats */
+static void linux_dmabuf_bind(struct wl_client *client, void *data,
+			      uint32_t version, uint32_t id)
+{
+	DLOG("%s\n", __FUNCTION__);
+	struct wl_resource *resource;
+
+	resource = wl_resource_create(client, &zwp_linux_dmabuf_v1_interface,
+				      version, id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &linux_dmabuf_interface,
+				       data, NULL);
+
+	for (int i = 0; i < s_format_num; i++) {
+		const dmabuf_format *f = &s_formats[i];
+
+		if (version < ZWP_LINUX_DMABUF_V1_MODIFIER_SINCE_VERSION) {
+			zwp_linux_dmabuf_v1_send_format(resource, f->format);
+			continue;
+		}
+		for (int j = 0; j < f->modifier_num; j++)
+			zwp_linux_dmabuf_v1_send_modifier(
+				resource, f->format, f->modifiers[j] >> 32,
+				f->modifiers[j] & 0xffffffff);
+		zwp_linux_dmabuf_v1_send_modifier(
+			resource, f->format, DRM_FORMAT_MOD_INVALID >> 32,
+			DRM_FORMAT_MOD_INVALID & 0xffffffff);
+	}
+}
+
+/*
+ * Modifiers EGL can only import for GL_TEXTURE_EXTERNAL_OES are left
+ * out, surfaces are sampled as GL_TEXTURE_2D. A format keeps the implicit
+ * modifier unless all of its modifiers are external only, as for the YUV
+ * formats of most drivers: it is not announced at all then (-1).
+ */
+static int linux_dmabuf_query_modifiers(dmabuf_format *f)
+{
+	EGLint num = 0;
+
+	if (!eglQueryDmaBufModifiersEXT(s_compositor->egl_display, f->format,
+					0, NULL, NULL, &num) ||
+	    num == 0)
+		return 0;
+
+	EGLuint64KHR *modifiers = calloc(num, sizeof(*modifiers));
+	EGLBoolean *external_only = calloc(num, sizeof(*external_only));
+	if (modifiers == NULL || external_only == NULL ||
+	    !eglQueryDmaBufModifiersEXT(s_compositor->egl_display, f->format,
+					num, modifiers, external_only, &num)) {
+		free(modifiers);
+		free(external_only);
+		return -1;
+	}
+
+	bool texture_2d = false;
+	f->modifiers = calloc(num, sizeof(*f->modifiers));
+	if (f->modifiers) {
+		for (int i = 0; i < num; i++) {
+			if (external_only[i])
+				continue;
+			texture_2d = true;
+			if (modifiers[i] != DRM_FORMAT_MOD_INVALID)
+				f->modifiers[f->modifier_num++] = modifiers[i];
+		}
+	}
+	free(modifiers);
+	free(external_only);
+	if (f->modifiers == NULL || !texture_2d) {
+		free(f->modifiers);
+		f->modifiers = NULL;
+		f->modifier_num = 0;
+		return -1;
+	}
+	return 0;
+}
+
+static int linux_dmabuf_query_formats(void)
+{
+	EGLint num = 0;
+	EGLint *formats = NULL;
+
+	if (s_modifiers) {
+		if (!eglQueryDmaBufFormatsEXT(s_compositor->egl_display, 0,
+					      NULL, &num))
+			num = 0;
+		formats = calloc(num ? num : 1, sizeof(*formats));
+		if (formats == NULL ||
+		    !eglQueryDmaBufFormatsEXT(s_compositor->egl_display, num,
+					      formats, &num)) {
+			free(formats);
+			return -1;
+		}
+	} else {
+		num = sizeof(s_default_formats) / sizeof(s_default_formats[0]);
+	}
+
+	s_formats = calloc(num ? num : 1, sizeof(*s_formats));
+	if (s_formats == NULL) {
+		free(formats);
+		return -1;
+	}
+	for (int i = 0; i < num; i++) {
+		dmabuf_format *f = &s_formats[s_format_num];
+
+		f->format = formats ? (uint32_t)formats[i] :
+				      s_default_formats[i];
+		if (s_modifiers && linux_dmabuf_query_modifiers(f) == -1)
+			continue;
+		s_format_num++;
+	}
+	free(formats);
+	return 0;
+}
+
+int linux_dmabuf_init(compositor *compositor, struct wl_display *display)
+{
+	const char *extensions =
+		eglQueryString(compositor->egl_display, EGL_EXTENSIONS);
+
+	s_compositor = compositor;
+	if (extensions == NULL ||
+	    strstr(extensions, "EGL_EXT_image_dma_buf_import") == NULL) {
+		ILOG("EGL_EXT_image_dma_buf_import is not supported, no zwp_linux_dmabuf_v1\n");
+		return 0;
+	}
+	s_modifiers = strstr(extensions,
+			     "EGL_EXT_image_dma_buf_import_modifiers") != NULL;
+
+	EGL_GET_PROC_ADDR(eglCreateImageKHR);
+	EGL_GET_PROC_ADDR(eglDestroyImageKHR);
+	if (s_modifiers) {
+		EGL_GET_PROC_ADDR(eglQueryDmaBufFormatsEXT);
+		EGL_GET_PROC_ADDR(eglQueryDmaBufModifiersEXT);
+		s_modifiers = eglQueryDmaBufFormatsEXT != NULL &&
+			      eglQueryDmaBufModifiersEXT != NULL;
+	}
+	if (eglCreateImageKHR == NULL || eglDestroyImageKHR == NULL ||
+	    linux_dmabuf_query_formats() == -1) {
+		ELOG("%s\n", __FUNCTION__);
+		return -1;
+	}
+
+	if (wl_global_create(display, &zwp_linux_dmabuf_v1_interface, 3,
+			     compositor, linux_dmabuf_bind) == NULL) {
+		ELOG("%s\n", __FUNCTION__);
+		return -1;
+	}
+	ILOG("zwp_linux_dmabuf_v1: %d formats, modifiers %s\n", s_format_num,
+	     s_modifiers ? "on" : "off");
+	return 0;
+}
+
+void linux_dmabuf_release(void)
+{
+	for (int i = 0; i < s_format_num; i++)
+		free(s_formats[i].modifiers);
+	free(s_formats);
+	s_formats = NULL;
+	s_format_num = 0;
+}
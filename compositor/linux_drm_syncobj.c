@@ -0,0 +1,744 @@
+// SPDX-License-Identifier: Apache-2.0
+/**
+ * Copyright (c) 2024  Panasonic Automotive Systems, Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * wp_linux_drm_syncobj_manager_v1, explicit synchronization of dmabufs.
+ *
+ * An acquire point may be set before the client has even submitted the
+ * rendering it stands for. Commits of a surface are therefore held here,
+ * in order, until the fence of their acquire point is available; the
+ * fence is then exported as a sync_file which the render thread hands to
+ * the GPU with eglWaitSyncKHR, so neither thread blocks on the client.
+ * The release point is signaled by the render thread once the commit is
+ * retired, through a native fence of the commands that sampled it.
+ *
+ * DRM syncobjs are driven with plain ioctls on the render node of the
+ * EGL display. Everything runs on the dispatch thread except
+ * linux_drm_syncobj_signal().
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/eventfd.h>
+#include <drm/drm.h>
+#include <wayland-server.h>
+#include <linux-drm-syncobj-v1-server-protocol.h>
+#include "util_egl.h"
+#include "util_log.h"
+#include "compositor.h"
+
+#ifndef DRM_CAP_SYNCOBJ_TIMELINE
+#define DRM_CAP_SYNCOBJ_TIMELINE 0x14
+#endif
+
+/* wp_linux_drm_syncobj_timeline_v1, outlives the resource while in use */
+typedef struct linux_drm_syncobj_timeline {
+	uint32_t handle;
+	int ref_count;
+} linux_drm_syncobj_timeline;
+
+/* wp_linux_drm_syncobj_surface_v1 */
+typedef struct linux_drm_syncobj_surface {
+	struct wl_resource *resource;
+	compositor_surface *csfc; /* NULL once the wl_surface is destroyed */
+	linux_drm_syncobj_point acquire; /* pending until the next commit */
+	linux_drm_syncobj_point release;
+} linux_drm_syncobj_surface;
+
+static PFNEGLQUERYDISPLAYATTRIBEXTPROC eglQueryDisplayAttribEXT;
+static PFNEGLQUERYDEVICESTRINGEXTPROC eglQueryDeviceStringEXT;
+
+static compositor *s_compositor = NULL;
+static int s_drm_fd = -1;
+static struct wl_list s_wait_list; /* surfaces with commits held back */
+static int s_event_fd = -1; /* DRM_IOCTL_SYNCOBJ_EVENTFD wakeups */
+static struct wl_event_source *s_event_source = NULL;
+static struct wl_event_source *s_poll_timer = NULL; /* without eventfd */
+static bool s_eventfd_supported = true;
+
+/*--------------------------------------------------------------------------- *
+ *  DRM syncobj
+ *--------------------------------------------------------------------------- */
+static int syncobj_create(uint32_t *handle)
+{
+	struct drm_syncobj_create args = { 0 };
+
+	if (ioctl(s_drm_fd, DRM_IOCTL_SYNCOBJ_CREATE, &args) == -1)
+		return -1;
+	*handle = args.handle;
+	return 0;
+}
+
+static void syncobj_destroy(uint32_t handle)
+{
+	struct drm_syncobj_destroy args = { .handle = handle };
+
+	ioctl(s_drm_fd, DRM_IOCTL_SYNCOBJ_DESTROY, &args);
+}
+
+/* a fence was attached to the point, it may not have signaled yet */
+static bool syncobj_point_available(const linux_drm_syncobj_point *point)
+{
+	struct drm_syncobj_timeline_wait args = {
+		.handles = (uintptr_t)&point->timeline->handle,
+		.points = (uintptr_t)&point->value,
+		.timeout_nsec = 0,
+		.count_handles = 1,
+		.flags = DRM_SYNCOBJ_WAIT_FLAGS_WAIT_FOR_SUBMIT |
+			 DRM_SYNCOBJ_WAIT_FLAGS_WAIT_AVAILABLE,
+	};
+
+	return ioctl(s_drm_fd, DRM_IOCTL_SYNCOBJ_TIMELINE_WAIT, &args) == 0;
+}
+
+/* timeline points are exported through a binary syncobj */
+static int syncobj_point_export(const linux_drm_syncobj_point *point)
+{
+	uint32_t handle;
+	int fd = -1;
+
+	if (syncobj_create(&handle) == -1)
+		return -1;
+
+	struct drm_syncobj_transfer transfer = {
+		.src_handle = point->timeline->handle,
+		.dst_handle = handle,
+		.src_point = point->value,
+		.dst_point = 0,
+	};
+	struct drm_syncobj_handle args = {
+		.handle = handle,
+		.flags = DRM_SYNCOBJ_HANDLE_TO_FD_FLAGS_EXPORT_SYNC_FILE,
+		.fd = -1,
+	};
+	if (ioctl(s_drm_fd, DRM_IOCTL_SYNCOBJ_TRANSFER, &transfer) == 0 &&
+	    ioctl(s_drm_fd, DRM_IOCTL_SYNCOBJ_HANDLE_TO_FD, &args) == 0)
+		fd = args.fd;
+	syncobj_destroy(handle);
+	return fd;
+}
+
+/* one-shot wakeup of s_event_fd once the point is available */
+static int syncobj_point_arm(const linux_drm_syncobj_point *point)
+{
+#ifdef DRM_IOCTL_SYNCOBJ_EVENTFD
+	struct drm_syncobj_eventfd args = {
+		.handle = point->timeline->handle,
+		.flags = DRM_SYNCOBJ_WAIT_FLAGS_WAIT_AVAILABLE,
+		.point = point->value,
+		.fd = s_event_fd,
+	};
+
+	return ioctl(s_drm_fd, DRM_IOCTL_SYNCOBJ_EVENTFD, &args);
+#else
+	errno = ENOTSUP;
+	return -1;
+#endif
+}
+
+/*
+ * Any thread. Without a fence the point is signaled right away, otherwise
+ * once fence_fd signals. The caller keeps fence_fd.
+ */
+void linux_drm_syncobj_signal(const linux_drm_syncobj_point *point,
+			      int fence_fd)
+{
+	uint32_t handle;
+
+	if (fence_fd >= 0 && syncobj_create(&handle) == 0) {
+		struct drm_syncobj_handle args = {
+			.handle = handle,
+			.flags = DRM_SYNCOBJ_FD_TO_HANDLE_FLAGS_IMPORT_SYNC_FILE,
+			.fd = fence_fd,
+		};
+		struct drm_syncobj_transfer transfer = {
+			.src_handle = handle,
+			.dst_handle = point->timeline->handle,
+			.src_point = 0,
+			.dst_point = point->value,
+		};
+		int ret = ioctl(s_drm_fd, DRM_IOCTL_SYNCOBJ_FD_TO_HANDLE, &args);
+		if (ret == 0)
+			ret = ioctl(s_drm_fd, DRM_IOCTL_SYNCOBJ_TRANSFER,
+				    &transfer);
+		syncobj_destroy(handle);
+		if (ret == 0)
+			return;
+		WLOG("%s fence transfer: %m\n", __FUNCTION__);
+	}
+
+	struct drm_syncobj_timeline_array args = {
+		.handles = (uintptr_t)&point->timeline->handle,
+		.points = (uintptr_t)&point->value,
+		.count_handles = 1,
+	};
+	if (ioctl(s_drm_fd, DRM_IOCTL_SYNCOBJ_TIMELINE_SIGNAL, &args) == -1)
+		ELOG("%s: %m\n", __FUNCTION__);
+}
+
+/*--------------------------------------------------------------------------- *
+ *  timeline points
+ *--------------------------------------------------------------------------- */
+static void timeline_unref(linux_drm_syncobj_timeline *timeline)
+{
+	if (--timeline->ref_count > 0)
+		return;
+	syncobj_destroy(timeline->handle);
+	free(timeline);
+}
+
+static void point_set(linux_drm_syncobj_point *point,
+		      linux_drm_syncobj_timeline *timeline, uint64_t value)
+{
+	if (timeline)
+		timeline->ref_count++;
+	if (point->timeline)
+		timeline_unref(point->timeline);
+	point->timeline = timeline;
+	point->value = value;
+}
+
+static void point_move(linux_drm_syncobj_point *dst,
+		       linux_drm_syncobj_point *src)
+{
+	if (dst->timeline)
+		timeline_unref(dst->timeline);
+	*dst = *src;
+	src->timeline = NULL;
+	src->value = 0;
+}
+
+/* dispatch thread, from render_commit_free() */
+void linux_drm_syncobj_commit_free(render_commit *rc)
+{
+	point_set(&rc->acquire_point, NULL, 0);
+	point_set(&rc->release_point, NULL, 0);
+	if (rc->acquire_fd >= 0) {
+		close(rc->acquire_fd);
+		rc->acquire_fd = -1;
+	}
+}
+
+/*--------------------------------------------------------------------------- *
+ *  held commits
+ *--------------------------------------------------------------------------- */
+/*
+ * A commit without an acquire point is always ready. A point whose fence
+ * cannot be exported is not waited for, the buffer falls back to implicit
+ * synchronization.
+ */
+static bool commit_acquire_ready(render_commit *rc)
+{
+	if (rc->acquire_point.timeline == NULL || rc->acquire_fd >= 0)
+		return true;
+	if (!syncobj_point_available(&rc->acquire_point))
+		return false;
+
+	rc->acquire_fd = syncobj_point_export(&rc->acquire_point);
+	if (rc->acquire_fd < 0)
+		WLOG("%s export: %m\n", __FUNCTION__);
+	return true;
+}
+
+static void commit_acquire_arm(render_commit *rc)
+{
+	if (s_eventfd_supported && syncobj_point_arm(&rc->acquire_point) == 0)
+		return;
+	if (s_eventfd_supported) {
+		ILOG("DRM_IOCTL_SYNCOBJ_EVENTFD: %m, poll acquire points\n");
+		s_eventfd_supported = false;
+	}
+	wl_event_source_timer_update(s_poll_timer, 1);
+}
+
+static void surface_submit_ready(compositor_surface *csfc)
+{
+	render_commit *rc, *next;
+
+	wl_list_for_each_safe(rc, next, &csfc->acquire_list, acquire_link)
+	{
+		if (!commit_acquire_ready(rc))
+			break;
+		wl_list_remove(&rc->acquire_link);
+		wl_list_init(&rc->acquire_link);
+		render_submit(s_compositor, rc);
+	}
+	if (wl_list_empty(&csfc->acquire_list)) {
+		wl_list_remove(&csfc->acquire_link);
+		wl_list_init(&csfc->acquire_link);
+	}
+}
+
+static void submit_ready(void)
+{
+	compositor_surface *csfc, *next;
+
+	wl_list_for_each_safe(csfc, next, &s_wait_list, acquire_link)
+	{
+		surface_submit_ready(csfc);
+	}
+	if (!s_eventfd_supported && !wl_list_empty(&s_wait_list))
+		wl_event_source_timer_update(s_poll_timer, 1);
+}
+
+static int acquire_event(int fd, uint32_t mask, void *data)
+{
+	uint64_t count;
+
+	if (read(fd, &count, sizeof(count)) < 0) {
+		/* EAGAIN: a wakeup of a point handled meanwhile */
+	}
+	submit_ready();
+	return 0;
+}
+
+static int acquire_poll(void *data)
+{
+	submit_ready();
+	return 0;
+}
+
+/*
+ * Replaces render_submit() for wl_surface.commit. Commits queue up behind
+ * a held commit of the same surface, also those without a buffer, so that
+ * the render thread still sees them in order.
+ */
+void linux_drm_syncobj_submit(compositor *compositor, render_commit *rc)
+{
+	compositor_surface *csfc = rc->csfc;
+
+	if (wl_list_empty(&csfc->acquire_list) && commit_acquire_ready(rc)) {
+		render_submit(compositor, rc);
+		return;
+	}
+
+	wl_list_insert(csfc->acquire_list.prev, &rc->acquire_link);
+	if (wl_list_empty(&csfc->acquire_link))
+		wl_list_insert(s_wait_list.prev, &csfc->acquire_link);
+	if (rc->acquire_point.timeline && rc->acquire_fd < 0)
+		commit_acquire_arm(rc);
+}
+
+/*
+ * Held commits are passed on unsynchronized: the destroy commit follows
+ * right away, so they are at most uploaded, never shown.
+ */
+void linux_drm_syncobj_surface_destroy(compositor_surface *csfc)
+{
+	render_commit *rc, *next;
+
+	if (csfc->syncobj) {
+		csfc->syncobj->csfc = NULL;
+		csfc->syncobj = NULL;
+	}
+	wl_list_for_each_safe(rc, next, &csfc->acquire_list, acquire_link)
+	{
+		wl_list_remove(&rc->acquire_link);
+		wl_list_init(&rc->acquire_link);
+		render_submit(csfc->compositor, rc);
+	}
+	wl_list_remove(&csfc->acquire_link);
+	wl_list_init(&csfc->acquire_link);
+}
+
+/*--------------------------------------------------------------------------- *
+ *  wl_surface.commit
+ *--------------------------------------------------------------------------- */
+static bool point_conflicts(const linux_drm_syncobj_point *acquire,
+			    const linux_drm_syncobj_point *release)
+{
+	return acquire->timeline == release->timeline &&
+	       acquire->value >= release->value;
+}
+
+/* protocol errors of the commit, before anything of it is applied */
+int linux_drm_syncobj_surface_check(compositor_surface *csfc)
+{
+	linux_drm_syncobj_surface *surface = csfc->syncobj;
+	struct wl_resource *buffer = csfc->pending_buffer;
+
+	if (surface == NULL)
+		return 0;
+
+	if (buffer == NULL) {
+		if (surface->acquire.timeline || surface->release.timeline) {
+			wl_resource_post_error(surface->resource,
+					       WP_LINUX_DRM_SYNCOBJ_SURFACE_V1_ERROR_NO_BUFFER,
+					       "timeline points set without a buffer");
+			return -1;
+		}
+		return 0;
+	}
+	if (surface->acquire.timeline == NULL) {
+		wl_resource_post_error(surface->resource,
+				       WP_LINUX_DRM_SYNCOBJ_SURFACE_V1_ERROR_NO_ACQUIRE_POINT,
+				       "no acquire timeline point");
+		return -1;
+	}
+	if (surface->release.timeline == NULL) {
+		wl_resource_post_error(surface->resource,
+				       WP_LINUX_DRM_SYNCOBJ_SURFACE_V1_ERROR_NO_RELEASE_POINT,
+				       "no release timeline point");
+		return -1;
+	}
+	/* shm content may be copied or sampled in place at any time */
+	if (wl_shm_buffer_get(buffer)) {
+		wl_resource_post_error(surface->resource,
+				       WP_LINUX_DRM_SYNCOBJ_SURFACE_V1_ERROR_UNSUPPORTED_BUFFER,
+				       "wl_shm buffers are not supported");
+		return -1;
+	}
+	if (point_conflicts(&surface->acquire, &surface->release)) {
+		wl_resource_post_error(surface->resource,
+				       WP_LINUX_DRM_SYNCOBJ_SURFACE_V1_ERROR_CONFLICTING_POINTS,
+				       "acquire point is not before the release point");
+		return -1;
+	}
+	return 0;
+}
+
+/* the pending points go with the commit of the attached buffer */
+void linux_drm_syncobj_commit_points(render_commit *rc)
+{
+	linux_drm_syncobj_surface *surface = rc->csfc->syncobj;
+
+	if (surface == NULL)
+		return;
+	point_move(&rc->acquire_point, &surface->acquire);
+	point_move(&rc->release_point, &surface->release);
+}
+
+/*--------------------------------------------------------------------------- *
+ *  wp_linux_drm_syncobj_surface_v1
+ *--------------------------------------------------------------------------- */
+static void syncobj_surface_destroy(struct wl_client *client,
+				    struct wl_resource *resource)
+{
+	DLOG("%s\n", __FUNCTION__);
+	wl_resource_destroy(resource);
+}
+
+static void syncobj_surface_resource_destroy(struct wl_resource *resource)
+{
+	linux_drm_syncobj_surface *surface =
+		wl_resource_get_user_data(resource);
+
+	if (surface->csfc)
+		surface->csfc->syncobj = NULL;
+	point_set(&surface->acquire, NULL, 0);
+	point_set(&surface->release, NULL, 0);
+	free(surface);
+}
+
+static void syncobj_surface_set_point(struct wl_resource *resource,
+				      struct wl_resource *timeline_resource,
+				      uint32_t point_hi, uint32_t point_lo,
+				      bool acquire)
+{
+	linux_drm_syncobj_surface *surface =
+		wl_resource_get_user_data(resource);
+
+	if (surface->csfc == NULL) {
+		wl_resource_post_error(resource,
+				       WP_LINUX_DRM_SYNCOBJ_SURFACE_V1_ERROR_NO_SURFACE,
+				       "the wl_surface was destroyed");
+		return;
+	}
+	point_set(acquire ? &surface->acquire : &surface->release,
+		  wl_resource_get_user_data(timeline_resource),
+		  ((uint64_t)point_hi << 32) | point_lo);
+}
+
+static void syncobj_surface_set_acquire_point(struct wl_client *client,
+					      struct wl_resource *resource,
+					      struct wl_resource *timeline,
+					      uint32_t point_hi,
+					      uint32_t point_lo)
+{
+	DLOG("%s\n", __FUNCTION__);
+	syncobj_surface_set_point(resource, timeline, point_hi, point_lo,
+				  true);
+}
+
+static void syncobj_surface_set_release_point(struct wl_client *client,
+					      struct wl_resource *resource,
+					      struct wl_resource *timeline,
+					      uint32_t point_hi,
+					      uint32_t point_lo)
+{
+	DLOG("%s\n", __FUNCTION__);
+	syncobj_surface_set_point(resource, timeline, point_hi, point_lo,
+				  false);
+}
+
+static const struct wp_linux_drm_syncobj_surface_v1_interface
+	syncobj_surface_interface = {
+		syncobj_surface_destroy,
+		syncobj_surface_set_acquire_point,
+		syncobj_surface_set_release_point,
+	};
+
+/*--------------------------------------------------------------------------- *
+ *  wp_linux_drm_syncobj_timeline_v1
+ *--------------------------------------------------------------------------- */
+static void syncobj_timeline_destroy(struct wl_client *client,
+				     struct wl_resource *resource)
+{
+	DLOG("%s\n", __FUNCTION__);
+	wl_resource_destroy(resource);
+}
+
+static void syncobj_timeline_resource_destroy(struct wl_resource *resource)
+{
+	timeline_unref(wl_resource_get_user_data(resource));
+}
+
+static const struct wp_linux_drm_syncobj_timeline_v1_interface
+	syncobj_timeline_interface = {
+		syncobj_timeline_destroy,
+	};
+
+/*--------------------------------------------------------------------------- *
+ *  wp_linux_drm_syncobj_manager_v1
+ *--------------------------------------------------------------------------- */
+static void syncobj_manager_destroy(struct wl_client *client,
+				    struct wl_resource *resource)
+{
+	DLOG("%s\n", __FUNCTION__);
+	wl_resource_destroy(resource);
+}
+
+static void syncobj_manager_get_surface(struct wl_client *client,
+					struct wl_resource *resource,
+					uint32_t id,
+					struct wl_resource *surface_resource)
+{
+	DLOG("%s\n", __FUNCTION__);
+	compositor_surface *csfc = wl_resource_get_user_data(surface_resource);
+	linux_drm_syncobj_surface *surface;
+
+	if (csfc->syncobj) {
+		wl_resource_post_error(resource,
+				       WP_LINUX_DRM_SYNCOBJ_MANAGER_V1_ERROR_SURFACE_EXISTS,
+				       "the surface already has a syncobj surface");
+		return;
+	}
+	surface = calloc(sizeof(*surface), 1);
+	if (surface == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	surface->resource =
+		wl_resource_create(client,
+				   &wp_linux_drm_syncobj_surface_v1_interface,
+				   wl_resource_get_version(resource), id);
+	if (surface->resource == NULL) {
+		free(surface);
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(surface->resource,
+				       &syncobj_surface_interface, surface,
+				       syncobj_surface_resource_destroy);
+	surface->csfc = csfc;
+	csfc->syncobj = surface;
+}
+
+static void syncobj_manager_import_timeline(struct wl_client *client,
+					    struct wl_resource *resource,
+					    uint32_t id, int32_t fd)
+{
+	DLOG("%s\n", __FUNCTION__);
+	struct drm_syncobj_handle args = { .fd = fd };
+	linux_drm_syncobj_timeline *timeline;
+
+	int ret = ioctl(s_drm_fd, DRM_IOCTL_SYNCOBJ_FD_TO_HANDLE, &args);
+	close(fd);
+	if (ret == -1) {
+		wl_resource_post_error(resource,
+				       WP_LINUX_DRM_SYNCOBJ_MANAGER_V1_ERROR_INVALID_TIMELINE,
+				       "importing the syncobj failed");
+		return;
+	}
+
+	timeline = calloc(sizeof(*timeline), 1);
+	if (timeline == NULL) {
+		syncobj_destroy(args.handle);
+		wl_client_post_no_memory(client);
+		return;
+	}
+	timeline->handle = args.handle;
+	timeline->ref_count = 1;
+
+	struct wl_resource *timeline_resource =
+		wl_resource_create(client,
+				   &wp_linux_drm_syncobj_timeline_v1_interface,
+				   wl_resource_get_version(resource), id);
+	if (timeline_resource == NULL) {
+		timeline_unref(timeline);
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(timeline_resource,
+				       &syncobj_timeline_interface, timeline,
+				       syncobj_timeline_resource_destroy);
+}
+
+static const struct wp_linux_drm_syncobj_manager_v1_interface
+	syncobj_manager_interface = {
+		syncobj_manager_destroy,
+		syncobj_manager_get_surface,
+		syncobj_manager_import_timeline,
+	};
+
+static void syncobj_manager_bind(struct wl_client *client, void *data,
+				 uint32_t version, uint32_t id)
+{
+	DLOG("%s\n", __FUNCTION__);
+	struct wl_resource *resource;
+
+	resource = wl_resource_create(
+		client, &wp_linux_drm_syncobj_manager_v1_interface, version, id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &syncobj_manager_interface,
+				       data, NULL);
+}
+
+/*--------------------------------------------------------------------------- *
+ *  global
+ *--------------------------------------------------------------------------- */
+/*
+ * The render node of the EGL device. Without EGLDevice the node cannot be
+ * told: syncobjs of another GPU would not be understood by the one EGL
+ * renders on, so explicit sync stays off.
+ */
+static int linux_drm_syncobj_open_device(EGLDisplay dpy)
+{
+	const char *client_extensions =
+		eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+	const char *path = NULL;
+
+	if (client_extensions &&
+	    strstr(client_extensions, "EGL_EXT_device_query")) {
+		EGLAttrib device = 0;
+
+		EGL_GET_PROC_ADDR(eglQueryDisplayAttribEXT);
+		EGL_GET_PROC_ADDR(eglQueryDeviceStringEXT);
+		if (eglQueryDisplayAttribEXT && eglQueryDeviceStringEXT &&
+		    eglQueryDisplayAttribEXT(dpy, EGL_DEVICE_EXT, &device)) {
+			path = eglQueryDeviceStringEXT(
+				(EGLDeviceEXT)device,
+				EGL_DRM_RENDER_NODE_FILE_EXT);
+			if (path == NULL)
+				path = eglQueryDeviceStringEXT(
+					(EGLDeviceEXT)device,
+					EGL_DRM_DEVICE_FILE_EXT);
+		}
+	}
+	if (path == NULL) {
+		ILOG("explicit sync: no DRM device of the EGL display\n");
+		return -1;
+	}
+
+	int fd = open(path, O_RDWR | O_CLOEXEC);
+	if (fd < 0)
+		ILOG("explicit sync: %s: %m\n", path);
+	return fd;
+}
+
+int linux_drm_syncobj_init(compositor *compositor, struct wl_display *display,
+			   bool enable)
+{
+	struct wl_event_loop *loop = wl_display_get_event_loop(display);
+	const char *extensions =
+		eglQueryString(compositor->egl_display, EGL_EXTENSIONS);
+
+	s_compositor = compositor;
+	wl_list_init(&s_wait_list);
+	if (!enable) {
+		ILOG("explicit sync: disabled\n");
+		return 0;
+	}
+	/* fences are exchanged with the GPU as sync_files */
+	if (extensions == NULL ||
+	    strstr(extensions, "EGL_ANDROID_native_fence_sync") == NULL ||
+	    strstr(extensions, "EGL_KHR_wait_sync") == NULL) {
+		ILOG("explicit sync: no EGL_ANDROID_native_fence_sync or EGL_KHR_wait_sync\n");
+		return 0;
+	}
+
+	s_drm_fd = linux_drm_syncobj_open_device(compositor->egl_display);
+	if (s_drm_fd < 0)
+		return 0;
+	struct drm_get_cap cap = { .capability = DRM_CAP_SYNCOBJ_TIMELINE };
+	if (ioctl(s_drm_fd, DRM_IOCTL_GET_CAP, &cap) == -1 || cap.value == 0) {
+		ILOG("explicit sync: no timeline syncobjs\n");
+		linux_drm_syncobj_release();
+		return 0;
+	}
+
+	s_event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (s_event_fd >= 0)
+		s_event_source = wl_event_loop_add_fd(loop, s_event_fd,
+						      WL_EVENT_READABLE,
+						      acquire_event, NULL);
+	s_poll_timer = wl_event_loop_add_timer(loop, acquire_poll, NULL);
+	if (s_event_source == NULL || s_poll_timer == NULL) {
+		ELOG("%s\n", __FUNCTION__);
+		linux_drm_syncobj_release();
+		return -1;
+	}
+
+	if (wl_global_create(display,
+			     &wp_linux_drm_syncobj_manager_v1_interface, 1,
+			     compositor, syncobj_manager_bind) == NULL) {
+		ELOG("%s\n", __FUNCTION__);
+		linux_drm_syncobj_release();
+		return -1;
+	}
+	ILOG("wp_linux_drm_syncobj_manager_v1: enabled\n");
+	return 0;
+}
+
+void linux_drm_syncobj_release(void)
+{
+	if (s_event_source) {
+		wl_event_source_remove(s_event_source);
+		s_event_source = NULL;
+	}
+	if (s_poll_timer) {
+		wl_event_source_remove(s_poll_timer);
+		s_poll_timer = NULL;
+	}
+	if (s_event_fd >= 0) {
+		close(s_event_fd);
+		s_event_fd = -1;
+	}
+	if (s_drm_fd >= 0) {
+		close(s_drm_fd);
+		s_drm_fd = -1;
+	}
+}
@@ -18,8 +18,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <wayland-server-protocol.h>
 #include <xdg-shell-server-protocol.h>
+#include <presentation-time-server-protocol.h>
 #include <wayland-server.h>
 #include "util_egl.h"
 #include <GLES2/gl2.h>
@@ -27,6 +29,7 @@
 #include <GLES3/gl3.h>
 #include "util_render2d.h"
 #include "util_log.h"
+#include "util_env.h"
 #include "compositor.h"
 #include <string.h>
 #include <poll.h>
@@ -39,8 +42,6 @@
 
 uint32_t getCurrentTimeMs(void);
 
-typedef enum { TEX_FREE, TEX_WRITING, TEX_COMPLETE } TexStatus;
-
 compositor_surface *focused_csfc = NULL;
 
 compositor_surface *get_top_compositor_surface(compositor *compositor)
@@ -61,14 +62,411 @@ typedef struct appopt_t {
 	bool sfc_fullscreen;
 	bool windowed;
 	bool vsync;
+	int repaint_window_msec;
+	int tex_slot_num;
+	bool pbo_upload;
+	int copy_worker_num;
+	bool shm_prefetch;
+	bool shm_import;
+	bool explicit_sync;
+	bool bench;
 } appopt_t;
 
 static PFNEGLBINDWAYLANDDISPLAYWL eglBindWaylandDisplayWL;
-static PFNGLEGLIMAGETARGETTEXTURE2DOESPROC glEGLImageTargetTexture2DOES;
 static PFNEGLQUERYWAYLANDBUFFERWL eglQueryWaylandBufferWL;
 static PFNEGLCREATEIMAGEKHRPROC eglCreateImageKHR;
 static PFNEGLDESTROYIMAGEKHRPROC eglDestroyImageKHR;
 
+/* keys the display import of dmabufs, never reused */
+static uint64_t s_scanout_id = 0;
+
+/*--------------------------------------------------------------------------- *
+ *  wl_buffer
+ *--------------------------------------------------------------------------- */
+/* the display import is dropped by the render thread */
+static void compositor_buffer_forget_scanout(compositor_buffer *buffer)
+{
+	render_commit *rc =
+		render_commit_create(RENDER_COMMIT_FORGET, NULL);
+
+	if (rc == NULL)
+		return;
+	rc->scanout.id = buffer->scanout_id;
+	render_submit(buffer->scanout_compositor, rc);
+}
+
+static void compositor_buffer_free(compositor_buffer *buffer)
+{
+	if (buffer->scanout_id)
+		compositor_buffer_forget_scanout(buffer);
+	if (buffer->egl_image != EGL_NO_IMAGE_KHR)
+		eglDestroyImageKHR(egl_get_display(), buffer->egl_image);
+	shm_import_buffer_release(buffer);
+	free(buffer);
+}
+
+static void compositor_buffer_destroy_handler(struct wl_listener *listener,
+					      void *data)
+{
+	compositor_buffer *buffer =
+		wl_container_of(listener, buffer, destroy_listener);
+
+	buffer->resource = NULL;
+	if (buffer->busy_count == 0)
+		compositor_buffer_free(buffer);
+}
+
+static compositor_buffer *
+compositor_buffer_from_resource(struct wl_resource *resource)
+{
+	compositor_buffer *buffer;
+	struct wl_listener *listener = wl_resource_get_destroy_listener(
+		resource, compositor_buffer_destroy_handler);
+
+	if (listener)
+		return wl_container_of(listener, buffer, destroy_listener);
+
+	buffer = calloc(sizeof(*buffer), 1);
+	if (buffer == NULL)
+		return NULL;
+	buffer->resource = resource;
+	buffer->destroy_listener.notify = compositor_buffer_destroy_handler;
+	wl_resource_add_destroy_listener(resource, &buffer->destroy_listener);
+	return buffer;
+}
+
+/*
+ * GPU buffers are imported once and the EGLImage is kept until the
+ * wl_buffer is destroyed. Commits of a client cycling through its
+ * buffers only rebind the image of the committed one. A buffer that
+ * fails is not retried on later commits.
+ */
+static void compositor_buffer_import(compositor *compositor,
+				     compositor_buffer *buffer)
+{
+	EGLDisplay dpy = compositor->egl_display;
+	linux_dmabuf_buffer *dmabuf = linux_dmabuf_buffer_get(buffer->resource);
+
+	if (dmabuf) {
+		buffer->width = dmabuf->width;
+		buffer->height = dmabuf->height;
+		buffer->egl_image = linux_dmabuf_buffer_import(compositor,
+							       dmabuf);
+	} else {
+		EGLint attribs = EGL_NONE;
+
+		eglQueryWaylandBufferWL(dpy, buffer->resource, EGL_WIDTH,
+					&buffer->width);
+		eglQueryWaylandBufferWL(dpy, buffer->resource, EGL_HEIGHT,
+					&buffer->height);
+		buffer->egl_image = eglCreateImageKHR(dpy, EGL_NO_CONTEXT,
+						      EGL_WAYLAND_BUFFER_WL,
+						      buffer->resource,
+						      &attribs);
+	}
+	if (buffer->egl_image == EGL_NO_IMAGE_KHR) {
+		ELOG("%s eglCreateImageKHR\n", __FUNCTION__);
+		buffer->import_failed = true;
+	}
+}
+
+/* the client may reuse the buffer once no commit refers to it anymore */
+static void compositor_buffer_put(compositor_buffer *buffer)
+{
+	if (--buffer->busy_count > 0)
+		return;
+	if (buffer->resource)
+		wl_buffer_send_release(buffer->resource);
+	else
+		compositor_buffer_free(buffer);
+}
+
+/*
+ * A dmabuf may be shown on an overlay plane, or flipped to in place of the
+ * composited frame when fullscreen, see render_repaint(). The fds are
+ * duplicated: the wl_buffer can be destroyed before the commit is
+ * repainted.
+ */
+static void render_commit_set_scanout(render_commit *rc)
+{
+	compositor_surface *csfc = rc->csfc;
+	shell_surface *shell_surface = csfc->shell_surface;
+	linux_dmabuf_buffer *dmabuf =
+		linux_dmabuf_buffer_get(rc->buffer->resource);
+
+	if (dmabuf == NULL)
+		return;
+	rc->scanout_fullscreen =
+		csfc->compositor->sfc_fullscreen ||
+		(shell_surface && shell_surface->toplevel &&
+		 shell_surface->toplevel->pending.state.fullscreen);
+	if (!rc->scanout_fullscreen && csfc->compositor->render.overlay_num == 0)
+		return;
+
+	if (rc->buffer->scanout_id == 0) {
+		rc->buffer->scanout_compositor = csfc->compositor;
+		rc->buffer->scanout_id = ++s_scanout_id;
+	}
+
+	winsys_dmabuf *buf = &rc->scanout;
+	for (int i = 0; i < dmabuf->plane_num; i++) {
+		buf->fd[i] = fcntl(dmabuf->planes[i].fd, F_DUPFD_CLOEXEC, 0);
+		if (buf->fd[i] < 0) {
+			ELOG("%s dup: %m\n", __FUNCTION__);
+			while (i-- > 0)
+				close(buf->fd[i]);
+			return;
+		}
+		buf->offset[i] = dmabuf->planes[i].offset;
+		buf->stride[i] = dmabuf->planes[i].stride;
+	}
+	buf->width = dmabuf->width;
+	buf->height = dmabuf->height;
+	buf->format = dmabuf->format;
+	buf->modifier = dmabuf->planes[0].modifier;
+	buf->plane_num = dmabuf->plane_num;
+	buf->id = rc->buffer->scanout_id;
+}
+
+/*
+ * Describe the attached buffer in the commit record. Everything that needs
+ * the wl_buffer resource happens here, while it is guaranteed to be alive;
+ * the EGLImage is created without a context and bound on the render thread.
+ */
+static void render_commit_set_buffer(render_commit *rc,
+				     struct wl_resource *buffer_resource)
+{
+	compositor_surface *csfc = rc->csfc;
+
+	rc->buffer = compositor_buffer_from_resource(buffer_resource);
+	if (rc->buffer == NULL) {
+		ELOG("%s\n", __FUNCTION__);
+		return;
+	}
+	rc->buffer->busy_count++;
+	rc->has_buffer = true;
+
+	struct wl_shm_buffer *shm_buf = wl_shm_buffer_get(buffer_resource);
+	if (shm_buf && rc->buffer->egl_image == EGL_NO_IMAGE_KHR)
+		rc->buffer->egl_image = shm_import_image(
+			csfc->compositor, rc->buffer, shm_buf);
+	if (shm_buf && rc->buffer->egl_image != EGL_NO_IMAGE_KHR) {
+		/* sampled in place: the buffer is held until retired */
+		rc->egl_image = rc->buffer->egl_image;
+		rc->egl_image_cached = true;
+		rc->width = wl_shm_buffer_get_width(shm_buf);
+		rc->height = wl_shm_buffer_get_height(shm_buf);
+	} else if (shm_buf && !shm_import_buffer_fits(rc->buffer, shm_buf)) {
+		/* shown as no content rather than read past the pool */
+		rc->width = wl_shm_buffer_get_width(shm_buf);
+		rc->height = wl_shm_buffer_get_height(shm_buf);
+	} else if (shm_buf) {
+		rc->shm_pool = wl_shm_buffer_ref_pool(shm_buf);
+		rc->shm_buffer = wl_shm_buffer_ref(shm_buf);
+		rc->shm_data = wl_shm_buffer_get_data(shm_buf);
+		rc->shm_stride = wl_shm_buffer_get_stride(shm_buf);
+		rc->shm_format = wl_shm_buffer_get_format(shm_buf);
+		rc->width = wl_shm_buffer_get_width(shm_buf);
+		rc->height = wl_shm_buffer_get_height(shm_buf);
+	} else {
+		if (rc->buffer->egl_image == EGL_NO_IMAGE_KHR &&
+		    !rc->buffer->import_failed)
+			compositor_buffer_import(csfc->compositor, rc->buffer);
+		rc->egl_image = rc->buffer->egl_image;
+		rc->egl_image_cached = true;
+		rc->width = rc->buffer->width;
+		rc->height = rc->buffer->height;
+		if (csfc->compositor->render.scanout)
+			render_commit_set_scanout(rc);
+	}
+	csfc->img_w = rc->width;
+	csfc->img_h = rc->height;
+}
+
+/*
+ * Surface damage is moved into buffer coordinates with the scale being
+ * committed. Rotated buffers are not drawn rotated, so their surface
+ * damage conservatively damages the whole buffer.
+ */
+static int32_t scale_coord(int32_t v, int32_t scale)
+{
+	int64_t scaled = (int64_t)v * scale;
+
+	if (scaled > INT32_MAX)
+		return INT32_MAX;
+	if (scaled < INT32_MIN)
+		return INT32_MIN;
+	return scaled;
+}
+
+static void render_commit_set_damage(render_commit *rc)
+{
+	compositor_surface *csfc = rc->csfc;
+	damage *surface_damage = &csfc->pending_damage;
+	int32_t scale = csfc->buffer_scale;
+
+	rc->damage = csfc->pending_buffer_damage;
+	if (surface_damage->full ||
+	    (surface_damage->num > 0 &&
+	     csfc->buffer_transform != WL_OUTPUT_TRANSFORM_NORMAL)) {
+		damage_set_full(&rc->damage);
+	} else {
+		for (int i = 0; i < surface_damage->num; i++) {
+			damage_rect *r = &surface_damage->rects[i];
+
+			damage_add(&rc->damage, scale_coord(r->x, scale),
+				   scale_coord(r->y, scale),
+				   scale_coord(r->w, scale),
+				   scale_coord(r->h, scale));
+		}
+	}
+
+	/* a client attaching without any damage gets a full upload */
+	if (damage_is_empty(&rc->damage))
+		damage_set_full(&rc->damage);
+	damage_clip(&rc->damage, rc->width, rc->height);
+}
+
+static void render_commit_frame_done(render_commit *rc, uint32_t time_msec)
+{
+	compositor_frame_callback *cb, *cnext;
+
+	wl_list_for_each_safe(cb, cnext, &rc->frame_callback_list, link)
+	{
+		wl_callback_send_done(cb->resource, time_msec);
+		wl_resource_destroy(cb->resource);
+	}
+}
+
+/* the surface may already be gone, the feedback outlives it */
+static void render_commit_presented(compositor *compositor, render_commit *rc)
+{
+	struct wl_resource *feedback, *fnext;
+	uint64_t sec = rc->present_nsec / 1000000000ULL;
+	uint32_t nsec = rc->present_nsec % 1000000000ULL;
+
+	wl_resource_for_each_safe(feedback, fnext, &rc->feedback_list)
+	{
+		struct wl_client *client = wl_resource_get_client(feedback);
+		struct wl_resource *output;
+
+		wl_resource_for_each(output, &compositor->output_list)
+		{
+			if (wl_resource_get_client(output) == client)
+				wp_presentation_feedback_send_sync_output(
+					feedback, output);
+		}
+		wp_presentation_feedback_send_presented(
+			feedback, sec >> 32, sec & 0xffffffff, nsec,
+			rc->present_refresh_nsec, rc->present_seq >> 32,
+			rc->present_seq & 0xffffffff, rc->present_flags);
+		wl_resource_destroy(feedback);
+	}
+}
+
+/* sent before the newer commit can be presented or retired */
+static void render_commit_superseded(render_commit *rc)
+{
+	render_commit *newer = rc->superseded_by;
+
+	wl_list_insert_list(newer->frame_callback_list.prev,
+			    &rc->frame_callback_list);
+	wl_list_init(&rc->frame_callback_list);
+	/* without a buffer the commit is presented with the newer one */
+	if (!rc->has_buffer) {
+		wl_list_insert_list(newer->feedback_list.prev,
+				    &rc->feedback_list);
+		wl_list_init(&rc->feedback_list);
+	}
+}
+
+static void render_commit_retired(render_commit *rc)
+{
+	compositor_frame_callback *cb, *cnext;
+	struct wl_resource *feedback, *fnext;
+
+	wl_list_for_each_safe(cb, cnext, &rc->frame_callback_list, link)
+	{
+		wl_resource_destroy(cb->resource);
+	}
+	wl_resource_for_each_safe(feedback, fnext, &rc->feedback_list)
+	{
+		wp_presentation_feedback_send_discarded(feedback);
+		wl_resource_destroy(feedback);
+	}
+	if (rc->buffer)
+		compositor_buffer_put(rc->buffer);
+	if (rc->type == RENDER_COMMIT_DESTROY)
+		free(rc->csfc);
+	render_commit_free(rc);
+}
+
+/* the content lives on in the staging copy */
+static void render_commit_released(render_commit *rc)
+{
+	if (rc->buffer) {
+		compositor_buffer_put(rc->buffer);
+		rc->buffer = NULL;
+	}
+	if (rc->shm_buffer) {
+		wl_shm_buffer_unref(rc->shm_buffer);
+		rc->shm_buffer = NULL;
+	}
+	if (rc->shm_pool) {
+		wl_shm_pool_unref(rc->shm_pool);
+		rc->shm_pool = NULL;
+	}
+}
+
+static void handle_render_frame(compositor *compositor, render_frame *frame)
+{
+	for (int i = 0; i < frame->entry_num; i++) {
+		render_commit *rc = frame->entries[i].commit;
+
+		if (frame->entries[i].presented)
+			render_commit_presented(compositor, rc);
+		else
+			render_commit_frame_done(rc, frame->time_msec);
+	}
+	free(frame);
+}
+
+/* frame-done and buffer-release events coming back from the render thread */
+static int handle_render_events(int fd, uint32_t mask, void *data)
+{
+	compositor *compositor = data;
+	render_queue *queue = &compositor->render.event_queue;
+	render_queue_node *node;
+	render_frame *frame;
+
+	render_queue_clear_event(queue);
+	pthread_mutex_lock(&compositor->event_mutex);
+	while ((node = render_queue_pop(queue)) != NULL) {
+		render_event *ev = wl_container_of(node, ev, node);
+
+		switch (ev->type) {
+		case RENDER_EVENT_FRAME:
+			frame = wl_container_of(ev, frame, event);
+			handle_render_frame(compositor, frame);
+			break;
+		case RENDER_EVENT_RELEASE:
+			render_commit_released(ev->commit);
+			break;
+		case RENDER_EVENT_SUPERSEDE:
+			render_commit_superseded(ev->commit);
+			break;
+		case RENDER_EVENT_RETIRE:
+			render_commit_retired(ev->commit);
+			break;
+		case RENDER_EVENT_EXIT:
+			compositor->running = false;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&compositor->event_mutex);
+	return 0;
+}
+
 /*--------------------------------------------------------------------------- *
  *  wl_surface
  *--------------------------------------------------------------------------- */
@@ -85,7 +483,21 @@ static void surface_attach(struct wl_client *client,
 {
 	DLOG("%s\n", __FUNCTION__);
 	compositor_surface *csfc = wl_resource_get_user_data(resource);
-	csfc->wl_buffer = buffer_resource;
+
+	if (csfc->pending_buffer)
+		wl_list_remove(&csfc->pending_buffer_destroy_listener.link);
+	csfc->pending_buffer = buffer_resource;
+	if (buffer_resource)
+		wl_resource_add_destroy_listener(
+			buffer_resource, &csfc->pending_buffer_destroy_listener);
+}
+
+static void pending_buffer_destroyed(struct wl_listener *listener, void *data)
+{
+	compositor_surface *csfc = wl_container_of(
+		listener, csfc, pending_buffer_destroy_listener);
+
+	csfc->pending_buffer = NULL;
 }
 
 static void surface_damage(struct wl_client *client,
@@ -93,6 +505,9 @@ static void surface_damage(struct wl_client *client,
 			   int32_t width, int32_t height)
 {
 	DLOG("%s\n", __FUNCTION__);
+	compositor_surface *csfc = wl_resource_get_user_data(resource);
+
+	damage_add(&csfc->pending_damage, x, y, width, height);
 }
 
 static void destroy_frame_callback(struct wl_resource *resource)
@@ -190,118 +605,48 @@ static void surface_commit(struct wl_client *client,
 			   struct wl_resource *resource)
 {
 	DLOG("%s\n", __FUNCTION__);
-	GLenum gl_internal_format[3] = { 0, 0, 0 };
-	GLenum gl_pixel_type;
-	int pitch;
-	int offset = 0;
-	int hsub = 1;
-	int vsub = 1;
 	compositor_surface *csfc = wl_resource_get_user_data(resource);
 
-	if (csfc->wl_buffer &&
-	    csfc->status[csfc->current_tex_index] == TEX_FREE) {
-		for (int i = 0; i < TEX_PLANE_NUM; i++) {
-			if (csfc->texid[i] == 0) {
-				glGenTextures(1, &csfc->texid[i]);
-				glBindTexture(GL_TEXTURE_2D, csfc->texid[i]);
-				glTexParameterf(GL_TEXTURE_2D,
-						GL_TEXTURE_MIN_FILTER,
-						GL_LINEAR);
-				glTexParameterf(GL_TEXTURE_2D,
-						GL_TEXTURE_MAG_FILTER,
-						GL_LINEAR);
-				glTexParameterf(GL_TEXTURE_2D,
-						GL_TEXTURE_WRAP_S,
-						GL_CLAMP_TO_EDGE);
-				glTexParameterf(GL_TEXTURE_2D,
-						GL_TEXTURE_WRAP_T,
-						GL_CLAMP_TO_EDGE);
-			}
-		}
-
-		struct wl_shm_buffer *shm_buf =
-			wl_shm_buffer_get(csfc->wl_buffer);
-		if (shm_buf) {
-			csfc->img_w = wl_shm_buffer_get_width(shm_buf);
-			csfc->img_h = wl_shm_buffer_get_height(shm_buf);
-			void *pixdata = wl_shm_buffer_get_data(shm_buf);
-			uint32_t format = wl_shm_buffer_get_format(shm_buf);
-
-			switch (format) {
-			case WL_SHM_FORMAT_XRGB8888:
-				pitch = wl_shm_buffer_get_stride(shm_buf) / 4;
-				gl_internal_format[0] = GL_BGRA_EXT;
-				gl_pixel_type = GL_UNSIGNED_BYTE;
-				break;
-			case WL_SHM_FORMAT_ARGB8888:
-				pitch = wl_shm_buffer_get_stride(shm_buf) / 4;
-				gl_internal_format[0] = GL_BGRA_EXT;
-				gl_pixel_type = GL_UNSIGNED_BYTE;
-				break;
-			case WL_SHM_FORMAT_RGB565:
-				pitch = wl_shm_buffer_get_stride(shm_buf) / 2;
-				gl_internal_format[0] = GL_RGB;
-				gl_pixel_type = GL_UNSIGNED_SHORT_5_6_5;
-				break;
-			default:
-				WLOG("%s unknown shm buffer format: %08x\n",
-				     __FUNCTION__, format);
-			}
+	if (linux_drm_syncobj_surface_check(csfc) == -1)
+		return;
 
-			GLenum gl_format;
-			switch (gl_internal_format[0]) {
-			case GL_R8_EXT:
-				gl_format = GL_RED_EXT;
-			case GL_RG8_EXT:
-				gl_format = GL_RG_EXT;
-			default:
-				gl_format = gl_internal_format[0];
-			}
-			glBindTexture(GL_TEXTURE_2D,
-				      csfc->texid[csfc->current_tex_index]);
-			glTexImage2D(GL_TEXTURE_2D, 0, gl_internal_format[0],
-				     pitch / hsub, csfc->img_h, 0, gl_format,
-				     gl_pixel_type, pixdata + offset);
-			glBindTexture(GL_TEXTURE_2D, 0);
-			csfc->glsyncobj_tex =
-				glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
-			csfc->status[csfc->current_tex_index] = TEX_WRITING;
-		} else {
-			eglQueryWaylandBufferWL(egl_get_display(),
-						csfc->wl_buffer, EGL_WIDTH,
-						&csfc->img_w);
-			eglQueryWaylandBufferWL(egl_get_display(),
-						csfc->wl_buffer, EGL_HEIGHT,
-						&csfc->img_h);
-
-			if (csfc->eglImg != EGL_NO_IMAGE_KHR) {
-				eglDestroyImageKHR(egl_get_display(),
-						   csfc->eglImg);
-				csfc->eglImg = EGL_NO_IMAGE_KHR;
-			}
-			EGLint attribs = EGL_NONE;
-			csfc->eglImg =
-				eglCreateImageKHR(egl_get_display(),
-						  EGL_NO_CONTEXT,
-						  EGL_WAYLAND_BUFFER_WL,
-						  csfc->wl_buffer, &attribs);
-
-			glBindTexture(GL_TEXTURE_2D,
-				      csfc->texid[csfc->current_tex_index]);
-			glEGLImageTargetTexture2DOES(GL_TEXTURE_2D,
-						     csfc->eglImg);
-			glBindTexture(GL_TEXTURE_2D, 0);
-			csfc->glsyncobj_tex =
-				glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
-			csfc->status[csfc->current_tex_index] = TEX_WRITING;
+	csfc->buffer_scale = csfc->pending_buffer_scale;
+	csfc->buffer_transform = csfc->pending_buffer_transform;
+
+	if (csfc->pending_buffer ||
+	    !wl_list_empty(&csfc->pending_frame_callback_list) ||
+	    !wl_list_empty(&csfc->pending_feedback_list)) {
+		render_commit *rc =
+			render_commit_create(RENDER_COMMIT_BUFFER, csfc);
+		if (rc == NULL) {
+			wl_resource_post_no_memory(resource);
+			return;
 		}
-	}
-	{
-		wl_list_insert_list(&csfc->frame_callback_list,
+		if (csfc->pending_buffer) {
+			pid_t pid;
+			wl_client_get_credentials(client, &pid, NULL, NULL);
+			rc->timeline_id = timeline_begin(
+				wl_resource_get_id(resource), pid);
+			render_commit_set_buffer(rc, csfc->pending_buffer);
+			render_commit_set_damage(rc);
+			linux_drm_syncobj_commit_points(rc);
+			wl_list_remove(&csfc->pending_buffer_destroy_listener.link);
+			csfc->pending_buffer = NULL;
+		}
+		wl_list_insert_list(&rc->frame_callback_list,
 				    &csfc->pending_frame_callback_list);
 		wl_list_init(&csfc->pending_frame_callback_list);
+		wl_list_insert_list(&rc->feedback_list,
+				    &csfc->pending_feedback_list);
+		wl_list_init(&csfc->pending_feedback_list);
+		if (rc->shm_pool && copy_pool_active())
+			copy_pool_submit(rc);
+		linux_drm_syncobj_submit(csfc->compositor, rc);
 	}
 
+	damage_init(&csfc->pending_damage);
+	damage_init(&csfc->pending_buffer_damage);
+
 	shell_surface *shell_surface = csfc->shell_surface;
 	if (shell_surface) {
 		if (shell_surface->added == 0 && shell_surface->toplevel) {
@@ -336,6 +681,17 @@ static void surface_set_buffer_transform(struct wl_client *client,
 					 int transform)
 {
 	DLOG("%s\n", __FUNCTION__);
+	compositor_surface *csfc = wl_resource_get_user_data(resource);
+
+	if (transform < WL_OUTPUT_TRANSFORM_NORMAL ||
+	    transform > WL_OUTPUT_TRANSFORM_FLIPPED_270) {
+		wl_resource_post_error(resource,
+				       WL_SURFACE_ERROR_INVALID_TRANSFORM,
+				       "buffer transform must be a valid transform (%d specified)",
+				       transform);
+		return;
+	}
+	csfc->pending_buffer_transform = transform;
 }
 
 static void surface_set_buffer_scale(struct wl_client *client,
@@ -343,6 +699,15 @@ static void surface_set_buffer_scale(struct wl_client *client,
 				     int32_t scale)
 {
 	DLOG("%s\n", __FUNCTION__);
+	compositor_surface *csfc = wl_resource_get_user_data(resource);
+
+	if (scale < 1) {
+		wl_resource_post_error(resource, WL_SURFACE_ERROR_INVALID_SCALE,
+				       "buffer scale must be at least one (%d specified)",
+				       scale);
+		return;
+	}
+	csfc->pending_buffer_scale = scale;
 }
 
 static void surface_damage_buffer(struct wl_client *client,
@@ -350,6 +715,9 @@ static void surface_damage_buffer(struct wl_client *client,
 				  int32_t y, int32_t width, int32_t height)
 {
 	DLOG("%s\n", __FUNCTION__);
+	compositor_surface *csfc = wl_resource_get_user_data(resource);
+
+	damage_add(&csfc->pending_buffer_damage, x, y, width, height);
 }
 
 static const struct wl_surface_interface surface_interface = {
@@ -402,18 +770,23 @@ compositor_surface *compositor_surface_create(compositor *compositor)
 	if (csfc == NULL)
 		return NULL;
 
+	csfc->compositor = compositor;
 	csfc->pointer_focused = false;
 	csfc->keyboard_focused = false;
-	csfc->eglImg = EGL_NO_IMAGE_KHR;
-	for (int i = 0; i < TEX_PLANE_NUM; i++) {
-		csfc->status[i] = TEX_FREE;
-	}
-	csfc->glsyncobj_tex = NULL;
-	csfc->current_tex_index = 0;
-	csfc->updated_tex_index = -1;
+	csfc->pending_buffer = NULL;
+	csfc->pending_buffer_destroy_listener.notify = pending_buffer_destroyed;
 	wl_list_init(&csfc->link);
 	wl_list_init(&csfc->pending_frame_callback_list);
-	wl_list_init(&csfc->frame_callback_list);
+	wl_list_init(&csfc->pending_feedback_list);
+	wl_list_init(&csfc->acquire_list);
+	wl_list_init(&csfc->acquire_link);
+	damage_init(&csfc->pending_damage);
+	damage_init(&csfc->pending_buffer_damage);
+	csfc->pending_buffer_scale = 1;
+	csfc->pending_buffer_transform = WL_OUTPUT_TRANSFORM_NORMAL;
+	csfc->buffer_scale = 1;
+	csfc->buffer_transform = WL_OUTPUT_TRANSFORM_NORMAL;
+	render_surface_init(csfc);
 
 	return csfc;
 }
@@ -421,14 +794,24 @@ compositor_surface *compositor_surface_create(compositor *compositor)
 void compositor_surface_destroy(compositor_surface *csfc)
 {
 	DLOG("%s\n", __FUNCTION__);
-	if (csfc->eglImg != EGL_NO_IMAGE_KHR)
-		eglDestroyImageKHR(egl_get_display(), csfc->eglImg);
+	compositor_frame_callback *cb, *cnext;
+	struct wl_resource *feedback, *fnext;
 
-	for (int i = 0; i < TEX_PLANE_NUM; i++) {
-		if (csfc->texid[i] != 0) {
-			glDeleteTextures(1, &csfc->texid[i]);
-		}
+	if (csfc->pending_buffer) {
+		wl_list_remove(&csfc->pending_buffer_destroy_listener.link);
+		csfc->pending_buffer = NULL;
 	}
+	wl_list_for_each_safe(cb, cnext, &csfc->pending_frame_callback_list,
+			      link)
+	{
+		wl_resource_destroy(cb->resource);
+	}
+	wl_resource_for_each_safe(feedback, fnext, &csfc->pending_feedback_list)
+	{
+		wp_presentation_feedback_send_discarded(feedback);
+		wl_resource_destroy(feedback);
+	}
+	csfc->resource = NULL;
 
 	wl_list_remove(&csfc->link);
 	wl_list_init(&csfc->link);
@@ -455,7 +838,24 @@ void compositor_surface_destroy(compositor_surface *csfc)
 			}
 		}
 	}
-	free(csfc);
+
+	linux_drm_syncobj_surface_destroy(csfc);
+
+	/* freed once the render thread has dropped its textures */
+	render_commit *rc = render_commit_create(RENDER_COMMIT_DESTROY, csfc);
+	if (rc == NULL)
+		return;
+	render_submit(csfc->compositor, rc);
+}
+
+static void compositor_surface_map(compositor_surface *csfc)
+{
+	wl_list_insert(csfc->compositor->surface_list.prev, &csfc->link);
+
+	render_commit *rc = render_commit_create(RENDER_COMMIT_MAP, csfc);
+	if (rc == NULL)
+		return;
+	render_submit(csfc->compositor, rc);
 }
 
 static void destroy_surface_resource(struct wl_resource *resource)
@@ -583,6 +983,11 @@ static const struct wl_output_interface output_interface = {
 	output_release,
 };
 
+static void output_resource_destroy(struct wl_resource *resource)
+{
+	wl_list_remove(wl_resource_get_link(resource));
+}
+
 static void output_bind(struct wl_client *client, void *data, uint32_t version,
 			uint32_t id)
 {
@@ -598,7 +1003,8 @@ static void output_bind(struct wl_client *client, void *data, uint32_t version,
 	}
 
 	wl_resource_set_implementation(resource, &output_interface, compositor,
-				       NULL);
+				       output_resource_destroy);
+	wl_list_insert(&compositor->output_list, wl_resource_get_link(resource));
 
 	wl_output_send_geometry(resource, 0, 0, compositor->width,
 				compositor->height, WL_OUTPUT_SUBPIXEL_NONE,
@@ -607,11 +1013,79 @@ static void output_bind(struct wl_client *client, void *data, uint32_t version,
 
 	wl_output_send_mode(resource,
 			    WL_OUTPUT_MODE_CURRENT | WL_OUTPUT_MODE_PREFERRED,
-			    compositor->width, compositor->height, 0);
+			    compositor->width, compositor->height,
+			    egl_get_refresh_mhz());
 
 	wl_output_send_done(resource);
 }
 
+/*--------------------------------------------------------------------------- *
+ *  wp_presentation
+ *--------------------------------------------------------------------------- */
+static void presentation_destroy(struct wl_client *client,
+				 struct wl_resource *resource)
+{
+	DLOG("%s\n", __FUNCTION__);
+	wl_resource_destroy(resource);
+}
+
+static void presentation_feedback_destroy(struct wl_resource *resource)
+{
+	wl_list_remove(wl_resource_get_link(resource));
+}
+
+/*
+ * The feedback belongs to the next wl_surface.commit. It is answered when
+ * the page flip showing that content completes, or discarded when the
+ * content is replaced before reaching the screen.
+ */
+static void presentation_feedback(struct wl_client *client,
+				  struct wl_resource *resource,
+				  struct wl_resource *surface_resource,
+				  uint32_t callback)
+{
+	DLOG("%s\n", __FUNCTION__);
+	compositor_surface *csfc = wl_resource_get_user_data(surface_resource);
+	struct wl_resource *feedback;
+
+	feedback = wl_resource_create(client,
+				      &wp_presentation_feedback_interface,
+				      wl_resource_get_version(resource),
+				      callback);
+	if (feedback == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(feedback, NULL, csfc,
+				       presentation_feedback_destroy);
+	wl_list_insert(csfc->pending_feedback_list.prev,
+		       wl_resource_get_link(feedback));
+}
+
+static const struct wp_presentation_interface presentation_interface = {
+	presentation_destroy,
+	presentation_feedback,
+};
+
+/* page flip timestamps are taken from CLOCK_MONOTONIC, see repaint.c */
+static void presentation_bind(struct wl_client *client, void *data,
+			      uint32_t version, uint32_t id)
+{
+	DLOG("%s\n", __FUNCTION__);
+	compositor *compositor = data;
+	struct wl_resource *resource;
+
+	resource = wl_resource_create(client, &wp_presentation_interface,
+				      version, id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &presentation_interface,
+				       compositor, NULL);
+	wp_presentation_send_clock_id(resource, CLOCK_MONOTONIC);
+}
+
 /*--------------------------------------------------------------------------- *
  *  wl_shell
  *--------------------------------------------------------------------------- */
@@ -760,7 +1234,7 @@ static void wl_shell_get_shell_surface(struct wl_client *wl_client,
 	}
 	csfc->shell_surface = shell_surface;
 	focused_csfc = csfc;
-	wl_list_insert(csfc->compositor->surface_list.prev, &csfc->link);
+	compositor_surface_map(csfc);
 }
 
 static const struct wl_shell_interface wl_shell_implementation = {
@@ -1081,7 +1555,7 @@ static void xdg_shell_get_xdg_surface(struct wl_client *wl_client,
 	}
 	csfc->shell_surface = shell_surface;
 	focused_csfc = csfc;
-	wl_list_insert(csfc->compositor->surface_list.prev, &csfc->link);
+	compositor_surface_map(csfc);
 }
 
 static void xdg_shell_pong(struct wl_client *wl_client,
@@ -1158,6 +1632,12 @@ static void usage(void)
 	info("\t-s size       \tspecify compositor window size (default: 1024x768)\n");
 	info("\t-S socket name\tspecify wayland socket name\n");
 	info("\t-f fullscreen \tsend fullscreen configuration to client\n");
+	info("\t-w msec       \tinitial repaint window before vblank (default: 7)\n");
+	info("\t-b slots      \ttexture ring depth per surface, 1 to %d (default: 2)\n",
+	     TEX_SLOT_MAX);
+	info("\t-u upload     \tshm upload path, pbo or direct (default: pbo)\n");
+	info("\t-c workers    \tshm copy threads, 0 to upload from client memory (default: 2)\n");
+	info("\t-B bench      \tmeasure the pixel conversion kernels and exit\n");
 	info("\t-h help       \tShow this message\n");
 
 	info("\nNote:\n");
@@ -1171,10 +1651,18 @@ static appopt_t parse_opt(int argc, char *argv[])
 	bool sfc_fullscreen = false;
 	bool vsync = false;
 	bool windowed = false;
+	int repaint_window_msec = 7;
+	int tex_slot_num = getenv_int("WLPROXY_TEX_SLOTS", 2);
+	char *shm_upload = getenv_str("WLPROXY_SHM_UPLOAD", "pbo");
+	int copy_worker_num = getenv_int("WLPROXY_COPY_WORKERS", 2);
+	bool shm_prefetch = getenv_int("WLPROXY_SHM_PREFETCH", 1) != 0;
+	bool shm_import = getenv_int("WLPROXY_SHM_IMPORT", 0) != 0;
+	bool explicit_sync = getenv_int("WLPROXY_EXPLICIT_SYNC", 1) != 0;
+	bool bench = false;
 
 	{
 		int c;
-		const char *optstring = "s:S:fvh";
+		const char *optstring = "s:S:fvw:b:u:c:Bh";
 		while ((c = getopt(argc, argv, optstring)) != -1) {
 			switch (c) {
 			case 's':
@@ -1194,6 +1682,26 @@ static appopt_t parse_opt(int argc, char *argv[])
 			case 'v':
 				vsync = true;
 				break;
+			case 'w':
+				repaint_window_msec = atoi(optarg);
+				if (repaint_window_msec < 0) {
+					ELOG("%s invalid repaint window %s\n",
+					     __FUNCTION__, optarg);
+					repaint_window_msec = 7;
+				}
+				break;
+			case 'b':
+				tex_slot_num = atoi(optarg);
+				break;
+			case 'u':
+				shm_upload = optarg;
+				break;
+			case 'c':
+				copy_worker_num = atoi(optarg);
+				break;
+			case 'B':
+				bench = true;
+				break;
 			case 'h':
 				usage();
 				exit(0);
@@ -1202,6 +1710,26 @@ static appopt_t parse_opt(int argc, char *argv[])
 		}
 	}
 
+	if (tex_slot_num < 1 || tex_slot_num > TEX_SLOT_MAX) {
+		ELOG("%s invalid texture ring depth %d\n", __FUNCTION__,
+		     tex_slot_num);
+		tex_slot_num = 2;
+	}
+
+	if (copy_worker_num < 0) {
+		ELOG("%s invalid copy worker count %d\n", __FUNCTION__,
+		     copy_worker_num);
+		copy_worker_num = 2;
+	}
+
+	bool pbo_upload = true;
+	if (strcmp(shm_upload, "direct") == 0) {
+		pbo_upload = false;
+	} else if (strcmp(shm_upload, "pbo") != 0) {
+		ELOG("%s invalid shm upload path %s\n", __FUNCTION__,
+		     shm_upload);
+	}
+
 	appopt_t appopt;
 	appopt.win_w = win_w;
 	appopt.win_h = win_h;
@@ -1209,107 +1737,31 @@ static appopt_t parse_opt(int argc, char *argv[])
 	appopt.sfc_fullscreen = sfc_fullscreen;
 	appopt.windowed = windowed;
 	appopt.vsync = vsync;
+	appopt.repaint_window_msec = repaint_window_msec;
+	appopt.tex_slot_num = tex_slot_num;
+	appopt.pbo_upload = pbo_upload;
+	appopt.copy_worker_num = copy_worker_num;
+	appopt.shm_prefetch = shm_prefetch;
+	appopt.shm_import = shm_import;
+	appopt.explicit_sync = explicit_sync;
+	appopt.bench = bench;
 	return appopt;
 }
 
-bool has_writting_tex(compositor *compositor)
-{
-	bool has_wrtting_tex = false;
-	compositor_surface *csfc;
-	wl_list_for_each(csfc, &compositor->surface_list, link)
-	{
-		if (csfc->status[csfc->current_tex_index] == TEX_WRITING) {
-			has_wrtting_tex = true;
-		}
-	}
-	return has_wrtting_tex;
-}
-
-bool has_updated_tex(compositor *compositor)
-{
-	compositor_surface *csfc;
-	bool has_updated_tex = false;
-	wl_list_for_each(csfc, &compositor->surface_list, link)
-	{
-		if (csfc->status[csfc->current_tex_index] == TEX_WRITING) {
-			GLenum result =
-				glClientWaitSync(csfc->glsyncobj_tex,
-						 GL_SYNC_FLUSH_COMMANDS_BIT, 0);
-			if (result == GL_ALREADY_SIGNALED) {
-				glDeleteSync(csfc->glsyncobj_tex);
-				csfc->glsyncobj_tex = NULL;
-				csfc->updated_tex_index =
-					csfc->current_tex_index;
-				csfc->current_tex_index =
-					(csfc->current_tex_index + 1) % 2;
-				csfc->status[csfc->current_tex_index] =
-					TEX_FREE;
-				csfc->status[csfc->updated_tex_index] =
-					TEX_COMPLETE;
-				has_updated_tex = true;
-
-				pthread_mutex_lock(
-					&csfc->compositor->event_mutex);
-				if (csfc->wl_used_buffer != NULL) {
-					wl_buffer_send_release(
-						csfc->wl_used_buffer);
-				}
-				csfc->wl_used_buffer = csfc->wl_buffer;
-
-				if (!wl_list_empty(
-					    &csfc->frame_callback_list)) {
-					compositor_frame_callback *cb, *cnext;
-					struct wl_list frame_callback_list;
-					wl_list_init(&frame_callback_list);
-					wl_list_insert_list(
-						&frame_callback_list,
-						&csfc->frame_callback_list);
-					wl_list_init(
-						&csfc->frame_callback_list);
-					uint32_t frame_time_msec =
-						getCurrentTimeMs();
-					wl_list_for_each_safe(
-						cb, cnext, &frame_callback_list,
-						link)
-					{
-						wl_callback_send_done(
-							cb->resource,
-							frame_time_msec);
-						wl_resource_destroy(
-							cb->resource);
-					}
-				}
-				pthread_mutex_unlock(
-					&csfc->compositor->event_mutex);
-			}
-		}
-	}
-	return has_updated_tex;
-}
-
-int update_surfaces(compositor *compositor, bool vsync)
+static int handle_timeline_signal(int signal_number, void *data)
 {
-	compositor_surface *csfc;
-	int ret;
-	glClear(GL_COLOR_BUFFER_BIT);
-	wl_list_for_each(csfc, &compositor->surface_list, link)
-	{
-		if (csfc->status[csfc->updated_tex_index] == TEX_COMPLETE) {
-			ret = draw_2d_texture(
-				csfc->texid[csfc->updated_tex_index], 0, 0,
-				csfc->img_w, csfc->img_h, 0);
-			if (ret == -1)
-				return ret;
-		}
-	}
-	ret = egl_swap(vsync);
-	return ret;
+	timeline_dump();
+	return 0;
 }
 
 static int handle_signal(int signal_number, void *data)
 {
 	DLOG("%s\n", __FUNCTION__);
 	compositor *compositor = data;
+	copy_pool_stop();
+	render_stop(compositor);
+	linux_drm_syncobj_release();
+	linux_dmabuf_release();
 	egl_terminate();
 	wl_display_destroy(compositor->wl_display);
 	pthread_mutex_destroy(&compositor->event_mutex);
@@ -1330,6 +1782,12 @@ int main(int argc, char *argv[])
 	bool windowed = appopt.windowed;
 	bool vsync = appopt.vsync;
 
+	pixel_convert_init();
+	if (appopt.bench) {
+		pixel_convert_bench();
+		return 0;
+	}
+
 	struct wl_display *wl_dpy = wl_display_create();
 	int ret = create_listening_socket(wl_dpy, appopt.socket_name);
 	if (ret == -1)
@@ -1359,9 +1817,12 @@ int main(int argc, char *argv[])
         compositor->width = win_w;
         compositor->height = win_h;
         compositor->sfc_fullscreen = sfc_fullscreen;
+        compositor->egl_display = egl_get_display();
+        compositor->running = true;
         pthread_mutex_init(&compositor->event_mutex, NULL);
         wl_list_init(&compositor->surface_list);
         wl_list_init(&compositor->client_list);
+        wl_list_init(&compositor->output_list);
 
         wl_global_create(wl_dpy, &wl_compositor_interface, 4, compositor,
                          compositor_bind);
@@ -1371,23 +1832,26 @@ int main(int argc, char *argv[])
                          wl_shell_bind);
         wl_global_create(wl_dpy, &xdg_wm_base_interface, 1, compositor,
                          xdg_shell_bind);
+        wl_global_create(wl_dpy, &wp_presentation_interface, 1, compositor,
+                         presentation_bind);
         wl_display_init_shm(wl_dpy);
 
         struct wl_event_loop *eloop = wl_display_get_event_loop(wl_dpy);
         wl_event_loop_add_signal(eloop, SIGINT, handle_signal, compositor);
         wl_event_loop_add_signal(eloop, SIGTERM, handle_signal, compositor);
+        wl_event_loop_add_signal(eloop, SIGUSR1, handle_timeline_signal,
+                                 compositor);
 
 	init_2d_renderer(win_w, win_h);
 	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
 	compositor_seat_init(compositor);
 
 	EGL_GET_PROC_ADDR(eglBindWaylandDisplayWL);
-	EGL_GET_PROC_ADDR(glEGLImageTargetTexture2DOES);
 	EGL_GET_PROC_ADDR(eglQueryWaylandBufferWL);
 	EGL_GET_PROC_ADDR(eglCreateImageKHR);
 	EGL_GET_PROC_ADDR(eglDestroyImageKHR);
 
-	EGLDisplay dpy = egl_get_display();
+	EGLDisplay dpy = compositor->egl_display;
 	const char *extensions = eglQueryString(dpy, EGL_EXTENSIONS);
 	if (extensions != NULL) {
 		ILOG("Support EGL EXTENSIONS: %s\n", extensions);
@@ -1400,42 +1864,45 @@ int main(int argc, char *argv[])
 	} else {
 		ILOG("EGL_WL_bind_wayland_display is not supported\n");
 	}
+	linux_dmabuf_init(compositor, wl_dpy);
+	linux_drm_syncobj_init(compositor, wl_dpy, appopt.explicit_sync);
+
+	ret = render_init(compositor, vsync, appopt.repaint_window_msec,
+			  appopt.tex_slot_num, appopt.pbo_upload);
+	if (ret == -1)
+		goto out;
+	render_add_shm_formats(wl_dpy);
+	pixel_convert_add_shm_formats(wl_dpy);
+	copy_pool_init(compositor, appopt.copy_worker_num,
+		       appopt.shm_prefetch);
+	shm_import_init(compositor, wl_dpy, appopt.shm_import);
+	wl_event_loop_add_fd(eloop, compositor->render.event_queue.event_fd,
+			     WL_EVENT_READABLE, handle_render_events,
+			     compositor);
 
 	glClear(GL_COLOR_BUFFER_BIT);
 	ret = egl_swap(vsync);
 	if (ret == -1)
 		goto out;
 
-	int pre_csfc_num = 0;
-	for (int count = 0;; count++) {
+	ret = render_start(compositor);
+	if (ret == -1)
+		goto out;
+
+	while (compositor->running) {
 		pthread_mutex_lock(&compositor->event_mutex);
 		wl_display_flush_clients(wl_dpy);
 		pthread_mutex_unlock(&compositor->event_mutex);
-		wl_event_loop_dispatch(eloop, -1);
 
-		bool need_update_tex_draw = has_writting_tex(compositor);
-		if (need_update_tex_draw) {
-			while (has_writting_tex(compositor)) {
-				if (has_updated_tex(compositor)) {
-					ret = update_surfaces(compositor,
-							      vsync);
-				} else {
-					usleep(100);
-				}
-			}
-		} else {
-			int csfc_num =
-				wl_list_length(&compositor->surface_list);
-			if (csfc_num != pre_csfc_num) {
-				ret = update_surfaces(compositor, vsync);
-				pre_csfc_num = csfc_num;
-			}
-		}
-		if (ret == -1)
-			break;
+		/* GL work runs on the render thread, only protocol is handled here */
+		wl_event_loop_dispatch(eloop, -1);
 	}
 
 out:
+	copy_pool_stop();
+	render_stop(compositor);
+	linux_drm_syncobj_release();
+	linux_dmabuf_release();
 	egl_terminate();
 	wl_display_destroy(wl_dpy);
 	pthread_mutex_destroy(&compositor->event_mutex);
@@ -0,0 +1,579 @@
+// SPDX-License-Identifier: Apache-2.0
+/**
+ * Copyright (c) 2024  Panasonic Automotive Systems, Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Row converters for the shm formats that GLES cannot sample directly,
+ * e.g. 10-bit formats without GL_EXT_texture_type_2_10_10_10_REV. Every
+ * kernel writes ARGB8888, i.e. the GL_BGRA_EXT byte order, with the alpha
+ * channel forced to opaque for formats without alpha. The fastest variant
+ * supported by the CPU is picked once at startup.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wayland-server.h>
+#include "util_egl.h"
+#include "util_log.h"
+#include "compositor.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PIXEL_X86 1
+#endif
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define PIXEL_NEON 1
+#endif
+
+#define ALPHA_MASK 0xff000000u
+
+static inline uint32_t load32(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline void store32(uint8_t *p, uint32_t v)
+{
+	memcpy(p, &v, sizeof(v));
+}
+
+static inline uint32_t swap_rb(uint32_t v)
+{
+	return (v & 0xff00ff00u) | ((v & 0xffu) << 16) | ((v >> 16) & 0xffu);
+}
+
+/* 2-bit alpha spread over 8 bits */
+static inline uint32_t alpha2(uint32_t v)
+{
+	return (v >> 30) * 0x55u;
+}
+
+/*--------------------------------------------------------------------------- *
+ *  scalar
+ *--------------------------------------------------------------------------- */
+static void xrgb8888_scalar(uint8_t *dst, const uint8_t *src, int32_t width)
+{
+	for (int32_t i = 0; i < width; i++)
+		store32(dst + i * 4, load32(src + i * 4) | ALPHA_MASK);
+}
+
+static void abgr8888_scalar(uint8_t *dst, const uint8_t *src, int32_t width)
+{
+	for (int32_t i = 0; i < width; i++)
+		store32(dst + i * 4, swap_rb(load32(src + i * 4)));
+}
+
+static void xbgr8888_scalar(uint8_t *dst, const uint8_t *src, int32_t width)
+{
+	for (int32_t i = 0; i < width; i++)
+		store32(dst + i * 4,
+			swap_rb(load32(src + i * 4)) | ALPHA_MASK);
+}
+
+/* little endian [23:0] R:G:B, the bytes already are in B, G, R order */
+static void rgb888_scalar(uint8_t *dst, const uint8_t *src, int32_t width)
+{
+	for (int32_t i = 0; i < width; i++) {
+		dst[i * 4 + 0] = src[i * 3 + 0];
+		dst[i * 4 + 1] = src[i * 3 + 1];
+		dst[i * 4 + 2] = src[i * 3 + 2];
+		dst[i * 4 + 3] = 0xff;
+	}
+}
+
+static void bgr888_scalar(uint8_t *dst, const uint8_t *src, int32_t width)
+{
+	for (int32_t i = 0; i < width; i++) {
+		dst[i * 4 + 0] = src[i * 3 + 2];
+		dst[i * 4 + 1] = src[i * 3 + 1];
+		dst[i * 4 + 2] = src[i * 3 + 0];
+		dst[i * 4 + 3] = 0xff;
+	}
+}
+
+/* 10-bit channels keep their 8 most significant bits */
+static inline uint32_t rgb30_to_rgb24(uint32_t v)
+{
+	return ((v >> 2) & 0xffu) | ((v >> 4) & 0xff00u) |
+	       ((v >> 6) & 0xff0000u);
+}
+
+static void argb2101010_scalar(uint8_t *dst, const uint8_t *src,
+			       int32_t width)
+{
+	for (int32_t i = 0; i < width; i++) {
+		uint32_t v = load32(src + i * 4);
+		store32(dst + i * 4, rgb30_to_rgb24(v) | alpha2(v) << 24);
+	}
+}
+
+static void xrgb2101010_scalar(uint8_t *dst, const uint8_t *src,
+			       int32_t width)
+{
+	for (int32_t i = 0; i < width; i++)
+		store32(dst + i * 4,
+			rgb30_to_rgb24(load32(src + i * 4)) | ALPHA_MASK);
+}
+
+static void abgr2101010_scalar(uint8_t *dst, const uint8_t *src,
+			       int32_t width)
+{
+	for (int32_t i = 0; i < width; i++) {
+		uint32_t v = load32(src + i * 4);
+		store32(dst + i * 4,
+			swap_rb(rgb30_to_rgb24(v)) | alpha2(v) << 24);
+	}
+}
+
+static void xbgr2101010_scalar(uint8_t *dst, const uint8_t *src,
+			       int32_t width)
+{
+	for (int32_t i = 0; i < width; i++)
+		store32(dst + i * 4,
+			swap_rb(rgb30_to_rgb24(load32(src + i * 4))) |
+				ALPHA_MASK);
+}
+
+/*--------------------------------------------------------------------------- *
+ *  SSE2, the x86-64 baseline
+ *--------------------------------------------------------------------------- */
+#ifdef PIXEL_X86
+__attribute__((target("sse2"))) static inline __m128i
+swap_rb_sse2(__m128i v)
+{
+	const __m128i ga = _mm_set1_epi32(0xff00ff00);
+	const __m128i lo = _mm_set1_epi32(0xff);
+
+	return _mm_or_si128(
+		_mm_and_si128(v, ga),
+		_mm_or_si128(_mm_slli_epi32(_mm_and_si128(v, lo), 16),
+			     _mm_and_si128(_mm_srli_epi32(v, 16), lo)));
+}
+
+__attribute__((target("sse2"))) static inline __m128i
+rgb30_to_rgb24_sse2(__m128i v)
+{
+	return _mm_or_si128(
+		_mm_and_si128(_mm_srli_epi32(v, 2), _mm_set1_epi32(0xff)),
+		_mm_or_si128(_mm_and_si128(_mm_srli_epi32(v, 4),
+					   _mm_set1_epi32(0xff00)),
+			     _mm_and_si128(_mm_srli_epi32(v, 6),
+					   _mm_set1_epi32(0xff0000))));
+}
+
+__attribute__((target("sse2"))) static inline __m128i
+alpha2_sse2(__m128i v)
+{
+	__m128i a = _mm_srli_epi32(v, 30);
+
+	a = _mm_or_si128(a, _mm_slli_epi32(a, 2));
+	a = _mm_or_si128(a, _mm_slli_epi32(a, 4));
+	return _mm_slli_epi32(a, 24);
+}
+
+#define SSE2_KERNEL(name, expr)                                                \
+	__attribute__((target("sse2"))) static void name##_sse2(               \
+		uint8_t *dst, const uint8_t *src, int32_t width)               \
+	{                                                                      \
+		const __m128i alpha = _mm_set1_epi32(ALPHA_MASK);              \
+		int32_t i = 0;                                                 \
+		(void)alpha;                                                   \
+		for (; i + 4 <= width; i += 4) {                               \
+			__m128i v = _mm_loadu_si128(                           \
+				(const __m128i *)(src + i * 4));               \
+			_mm_storeu_si128((__m128i *)(dst + i * 4), expr);      \
+		}                                                              \
+		name##_scalar(dst + i * 4, src + i * 4, width - i);            \
+	}
+
+SSE2_KERNEL(xrgb8888, _mm_or_si128(v, alpha))
+SSE2_KERNEL(abgr8888, swap_rb_sse2(v))
+SSE2_KERNEL(xbgr8888, _mm_or_si128(swap_rb_sse2(v), alpha))
+SSE2_KERNEL(argb2101010, _mm_or_si128(rgb30_to_rgb24_sse2(v), alpha2_sse2(v)))
+SSE2_KERNEL(xrgb2101010, _mm_or_si128(rgb30_to_rgb24_sse2(v), alpha))
+SSE2_KERNEL(abgr2101010,
+	    _mm_or_si128(swap_rb_sse2(rgb30_to_rgb24_sse2(v)), alpha2_sse2(v)))
+SSE2_KERNEL(xbgr2101010,
+	    _mm_or_si128(swap_rb_sse2(rgb30_to_rgb24_sse2(v)), alpha))
+
+/*--------------------------------------------------------------------------- *
+ *  AVX2
+ *--------------------------------------------------------------------------- */
+__attribute__((target("avx2"))) static inline __m256i
+rgb30_to_rgb24_avx2(__m256i v)
+{
+	return _mm256_or_si256(
+		_mm256_and_si256(_mm256_srli_epi32(v, 2),
+				 _mm256_set1_epi32(0xff)),
+		_mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(v, 4),
+						 _mm256_set1_epi32(0xff00)),
+				_mm256_and_si256(_mm256_srli_epi32(v, 6),
+						 _mm256_set1_epi32(0xff0000))));
+}
+
+__attribute__((target("avx2"))) static inline __m256i
+alpha2_avx2(__m256i v)
+{
+	__m256i a = _mm256_srli_epi32(v, 30);
+
+	a = _mm256_or_si256(a, _mm256_slli_epi32(a, 2));
+	a = _mm256_or_si256(a, _mm256_slli_epi32(a, 4));
+	return _mm256_slli_epi32(a, 24);
+}
+
+#define AVX2_SWAP_RB                                                           \
+	_mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15, \
+			 2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15)
+
+#define AVX2_KERNEL(name, expr)                                                \
+	__attribute__((target("avx2"))) static void name##_avx2(               \
+		uint8_t *dst, const uint8_t *src, int32_t width)               \
+	{                                                                      \
+		const __m256i alpha = _mm256_set1_epi32(ALPHA_MASK);           \
+		const __m256i swap = AVX2_SWAP_RB;                             \
+		int32_t i = 0;                                                 \
+		(void)alpha;                                                   \
+		(void)swap;                                                    \
+		for (; i + 8 <= width; i += 8) {                               \
+			__m256i v = _mm256_loadu_si256(                        \
+				(const __m256i *)(src + i * 4));               \
+			_mm256_storeu_si256((__m256i *)(dst + i * 4), expr);   \
+		}                                                              \
+		name##_scalar(dst + i * 4, src + i * 4, width - i);            \
+	}
+
+AVX2_KERNEL(xrgb8888, _mm256_or_si256(v, alpha))
+AVX2_KERNEL(abgr8888, _mm256_shuffle_epi8(v, swap))
+AVX2_KERNEL(xbgr8888, _mm256_or_si256(_mm256_shuffle_epi8(v, swap), alpha))
+AVX2_KERNEL(argb2101010,
+	    _mm256_or_si256(rgb30_to_rgb24_avx2(v), alpha2_avx2(v)))
+AVX2_KERNEL(xrgb2101010, _mm256_or_si256(rgb30_to_rgb24_avx2(v), alpha))
+AVX2_KERNEL(abgr2101010,
+	    _mm256_or_si256(_mm256_shuffle_epi8(rgb30_to_rgb24_avx2(v), swap),
+			    alpha2_avx2(v)))
+AVX2_KERNEL(xbgr2101010,
+	    _mm256_or_si256(_mm256_shuffle_epi8(rgb30_to_rgb24_avx2(v), swap),
+			    alpha))
+
+/*
+ * 8 pixels of 3 bytes per iteration: each 128-bit lane is loaded with 4
+ * pixels and expanded in place. The second load reads 4 bytes past the 24
+ * converted ones, hence the loop bound.
+ */
+#define AVX2_EXPAND_KERNEL(name, b0, b1, b2)                                   \
+	__attribute__((target("avx2"))) static void name##_avx2(               \
+		uint8_t *dst, const uint8_t *src, int32_t width)               \
+	{                                                                      \
+		const __m256i expand = _mm256_setr_epi8(                       \
+			b0, b1, b2, -1, b0 + 3, b1 + 3, b2 + 3, -1, b0 + 6,    \
+			b1 + 6, b2 + 6, -1, b0 + 9, b1 + 9, b2 + 9, -1, b0,    \
+			b1, b2, -1, b0 + 3, b1 + 3, b2 + 3, -1, b0 + 6,        \
+			b1 + 6, b2 + 6, -1, b0 + 9, b1 + 9, b2 + 9, -1);       \
+		const __m256i alpha = _mm256_set1_epi32(ALPHA_MASK);           \
+		int32_t i = 0;                                                 \
+		for (; i + 10 <= width; i += 8) {                              \
+			__m256i v = _mm256_inserti128_si256(                   \
+				_mm256_castsi128_si256(_mm_loadu_si128(        \
+					(const __m128i *)(src + i * 3))),      \
+				_mm_loadu_si128(                               \
+					(const __m128i *)(src + i * 3 + 12)),  \
+				1);                                            \
+			v = _mm256_or_si256(_mm256_shuffle_epi8(v, expand),    \
+					    alpha);                            \
+			_mm256_storeu_si256((__m256i *)(dst + i * 4), v);      \
+		}                                                              \
+		name##_scalar(dst + i * 4, src + i * 3, width - i);            \
+	}
+
+AVX2_EXPAND_KERNEL(rgb888, 0, 1, 2)
+AVX2_EXPAND_KERNEL(bgr888, 2, 1, 0)
+#endif /* PIXEL_X86 */
+
+/*--------------------------------------------------------------------------- *
+ *  NEON, mandatory on AArch64
+ *--------------------------------------------------------------------------- */
+#ifdef PIXEL_NEON
+#define NEON_KERNEL(name, src_bpp, load, b, g, r, a)                           \
+	static void name##_neon(uint8_t *dst, const uint8_t *src,              \
+				int32_t width)                                 \
+	{                                                                      \
+		int32_t i = 0;                                                 \
+		for (; i + 16 <= width; i += 16) {                             \
+			load v = vld##src_bpp##q_u8(src + i * src_bpp);        \
+			uint8x16x4_t o;                                        \
+			o.val[0] = b;                                          \
+			o.val[1] = g;                                          \
+			o.val[2] = r;                                          \
+			o.val[3] = a;                                          \
+			vst4q_u8(dst + i * 4, o);                              \
+		}                                                              \
+		name##_scalar(dst + i * 4, src + i * src_bpp, width - i);      \
+	}
+
+NEON_KERNEL(xrgb8888, 4, uint8x16x4_t, v.val[0], v.val[1], v.val[2],
+	    vdupq_n_u8(0xff))
+NEON_KERNEL(abgr8888, 4, uint8x16x4_t, v.val[2], v.val[1], v.val[0],
+	    v.val[3])
+NEON_KERNEL(xbgr8888, 4, uint8x16x4_t, v.val[2], v.val[1], v.val[0],
+	    vdupq_n_u8(0xff))
+NEON_KERNEL(rgb888, 3, uint8x16x3_t, v.val[0], v.val[1], v.val[2],
+	    vdupq_n_u8(0xff))
+NEON_KERNEL(bgr888, 3, uint8x16x3_t, v.val[2], v.val[1], v.val[0],
+	    vdupq_n_u8(0xff))
+
+static inline uint32x4_t rgb30_to_rgb24_neon(uint32x4_t v)
+{
+	return vorrq_u32(
+		vandq_u32(vshrq_n_u32(v, 2), vdupq_n_u32(0xff)),
+		vorrq_u32(vandq_u32(vshrq_n_u32(v, 4), vdupq_n_u32(0xff00)),
+			  vandq_u32(vshrq_n_u32(v, 6), vdupq_n_u32(0xff0000))));
+}
+
+static inline uint32x4_t alpha2_neon(uint32x4_t v)
+{
+	return vshlq_n_u32(vmulq_n_u32(vshrq_n_u32(v, 30), 0x55), 24);
+}
+
+static inline uint32x4_t swap_rb_neon(uint32x4_t v)
+{
+	static const uint8_t idx[16] = { 2, 1, 0, 3, 6, 5, 4, 7,
+					 10, 9, 8, 11, 14, 13, 12, 15 };
+
+	return vreinterpretq_u32_u8(
+		vqtbl1q_u8(vreinterpretq_u8_u32(v), vld1q_u8(idx)));
+}
+
+#define NEON_RGB30_KERNEL(name, expr)                                          \
+	static void name##_neon(uint8_t *dst, const uint8_t *src,              \
+				int32_t width)                                 \
+	{                                                                      \
+		const uint32x4_t alpha = vdupq_n_u32(ALPHA_MASK);              \
+		int32_t i = 0;                                                 \
+		(void)alpha;                                                   \
+		for (; i + 4 <= width; i += 4) {                               \
+			uint32x4_t v = vreinterpretq_u32_u8(                   \
+				vld1q_u8(src + i * 4));                        \
+			vst1q_u8(dst + i * 4, vreinterpretq_u8_u32(expr));     \
+		}                                                              \
+		name##_scalar(dst + i * 4, src + i * 4, width - i);            \
+	}
+
+NEON_RGB30_KERNEL(argb2101010, vorrq_u32(rgb30_to_rgb24_neon(v),
+					 alpha2_neon(v)))
+NEON_RGB30_KERNEL(xrgb2101010, vorrq_u32(rgb30_to_rgb24_neon(v), alpha))
+NEON_RGB30_KERNEL(abgr2101010,
+		  vorrq_u32(swap_rb_neon(rgb30_to_rgb24_neon(v)),
+			    alpha2_neon(v)))
+NEON_RGB30_KERNEL(xbgr2101010,
+		  vorrq_u32(swap_rb_neon(rgb30_to_rgb24_neon(v)), alpha))
+#endif /* PIXEL_NEON */
+
+/*--------------------------------------------------------------------------- *
+ *  dispatch
+ *--------------------------------------------------------------------------- */
+typedef enum pixel_isa {
+	PIXEL_ISA_SCALAR,
+	PIXEL_ISA_SSE2,
+	PIXEL_ISA_AVX2,
+	PIXEL_ISA_NEON,
+	PIXEL_ISA_NUM,
+} pixel_isa;
+
+static const char *s_isa_name[PIXEL_ISA_NUM] = {
+	"scalar", "sse2", "avx2", "neon",
+};
+
+typedef struct pixel_kernel {
+	pixel_converter converter; /* selected variant */
+	const char *name;
+	pixel_convert_func variants[PIXEL_ISA_NUM];
+} pixel_kernel;
+
+#ifdef PIXEL_X86
+#define X86_VARIANTS(name, sse2)                                               \
+	[PIXEL_ISA_SSE2] = sse2, [PIXEL_ISA_AVX2] = name##_avx2,
+#else
+#define X86_VARIANTS(name, sse2)
+#endif
+#ifdef PIXEL_NEON
+#define NEON_VARIANTS(name) [PIXEL_ISA_NEON] = name##_neon,
+#else
+#define NEON_VARIANTS(name)
+#endif
+
+/* 3-byte formats have no SSE2 variant, a byte shuffle needs SSSE3 */
+#define KERNEL(format, name, bpp, sse2)                                        \
+	{                                                                      \
+		{ WL_SHM_FORMAT_##format, bpp, name##_scalar }, #name,         \
+		{                                                              \
+			[PIXEL_ISA_SCALAR] = name##_scalar,                    \
+			X86_VARIANTS(name, sse2) NEON_VARIANTS(name)           \
+		}                                                              \
+	}
+
+static pixel_kernel s_kernels[] = {
+	KERNEL(XRGB8888, xrgb8888, 4, xrgb8888_sse2),
+	KERNEL(ABGR8888, abgr8888, 4, abgr8888_sse2),
+	KERNEL(XBGR8888, xbgr8888, 4, xbgr8888_sse2),
+	KERNEL(RGB888, rgb888, 3, NULL),
+	KERNEL(BGR888, bgr888, 3, NULL),
+	KERNEL(ARGB2101010, argb2101010, 4, argb2101010_sse2),
+	KERNEL(XRGB2101010, xrgb2101010, 4, xrgb2101010_sse2),
+	KERNEL(ABGR2101010, abgr2101010, 4, abgr2101010_sse2),
+	KERNEL(XBGR2101010, xbgr2101010, 4, xbgr2101010_sse2),
+};
+
+#define KERNEL_NUM (int)(sizeof(s_kernels) / sizeof(s_kernels[0]))
+
+static bool isa_supported(pixel_isa isa)
+{
+	switch (isa) {
+	case PIXEL_ISA_SCALAR:
+		return true;
+#ifdef PIXEL_X86
+	case PIXEL_ISA_SSE2:
+		return __builtin_cpu_supports("sse2");
+	case PIXEL_ISA_AVX2:
+		return __builtin_cpu_supports("avx2");
+#endif
+#ifdef PIXEL_NEON
+	case PIXEL_ISA_NEON:
+		return true;
+#endif
+	default:
+		return false;
+	}
+}
+
+/* WLPROXY_PIXEL_ISA=scalar helps telling kernel bugs from driver bugs */
+void pixel_convert_init(void)
+{
+	char *forced = getenv_str("WLPROXY_PIXEL_ISA", NULL);
+	pixel_isa best = PIXEL_ISA_SCALAR;
+
+	for (int isa = PIXEL_ISA_NUM - 1; isa > PIXEL_ISA_SCALAR; isa--) {
+		if (isa_supported(isa) &&
+		    (forced == NULL || strcmp(forced, s_isa_name[isa]) == 0)) {
+			best = isa;
+			break;
+		}
+	}
+
+	/* kernels without a variant for the best ISA take the next one */
+	for (int k = 0; k < KERNEL_NUM; k++) {
+		pixel_kernel *kernel = &s_kernels[k];
+
+		for (int isa = best; isa >= PIXEL_ISA_SCALAR; isa--) {
+			if (kernel->variants[isa] && isa_supported(isa)) {
+				kernel->converter.convert =
+					kernel->variants[isa];
+				break;
+			}
+		}
+	}
+	ILOG("pixel conversion: %s\n", s_isa_name[best]);
+}
+
+const pixel_converter *pixel_convert_lookup(uint32_t shm_format)
+{
+	for (int k = 0; k < KERNEL_NUM; k++) {
+		if (s_kernels[k].converter.shm_format == shm_format)
+			return &s_kernels[k].converter;
+	}
+	return NULL;
+}
+
+/* formats GL samples directly are advertised by render_add_shm_formats() */
+void pixel_convert_add_shm_formats(struct wl_display *display)
+{
+	for (int k = 0; k < KERNEL_NUM; k++) {
+		uint32_t format = s_kernels[k].converter.shm_format;
+
+		if (format != WL_SHM_FORMAT_XRGB8888 &&
+		    format != WL_SHM_FORMAT_ARGB8888 &&
+		    !render_shm_format_native(format))
+			wl_display_add_shm_format(display, format);
+	}
+}
+
+/*--------------------------------------------------------------------------- *
+ *  micro-benchmark
+ *--------------------------------------------------------------------------- */
+#define BENCH_WIDTH 1920
+#define BENCH_HEIGHT 1080
+#define BENCH_NSEC 200000000ULL
+
+/* GB/s of source pixels converted, a full 1080p frame per call */
+void pixel_convert_bench(void)
+{
+	size_t size = (size_t)BENCH_WIDTH * BENCH_HEIGHT * 4;
+	uint8_t *src = aligned_alloc(64, size);
+	uint8_t *dst = aligned_alloc(64, size);
+
+	if (src == NULL || dst == NULL) {
+		ELOG("%s\n", __FUNCTION__);
+		free(src);
+		free(dst);
+		return;
+	}
+	for (size_t i = 0; i < size; i++)
+		src[i] = (uint8_t)(i * 7);
+	memset(dst, 0, size);
+
+	ILOG("%-12s", "kernel");
+	for (int isa = 0; isa < PIXEL_ISA_NUM; isa++)
+		LOG(" %8s", s_isa_name[isa]);
+	LOG("  (GB/s)\n");
+
+	for (int k = 0; k < KERNEL_NUM; k++) {
+		pixel_kernel *kernel = &s_kernels[k];
+		size_t frame = (size_t)BENCH_WIDTH * BENCH_HEIGHT *
+			       kernel->converter.bpp;
+
+		ILOG("%-12s", kernel->name);
+		for (int isa = 0; isa < PIXEL_ISA_NUM; isa++) {
+			pixel_convert_func convert = kernel->variants[isa];
+			if (convert == NULL || !isa_supported(isa)) {
+				LOG(" %8s", "-");
+				continue;
+			}
+
+			uint64_t start = get_monotonic_nsec();
+			uint64_t elapsed;
+			int frames = 0;
+			do {
+				for (int y = 0; y < BENCH_HEIGHT; y++)
+					convert(dst + (size_t)y * BENCH_WIDTH *
+							      4,
+						src + (size_t)y * BENCH_WIDTH *
+							      kernel->converter
+								      .bpp,
+						BENCH_WIDTH);
+				frames++;
+				elapsed = get_monotonic_nsec() - start;
+			} while (elapsed < BENCH_NSEC);
+			LOG(" %8.2f", (double)frame * frames / elapsed);
+		}
+		LOG("\n");
+	}
+	free(src);
+	free(dst);
+}
@@ -0,0 +1,1834 @@
+// SPDX-License-Identifier: Apache-2.0
+/**
+ * Copyright (c) 2024  Panasonic Automotive Systems, Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * The render thread owns the EGL context. Protocol handlers on the
+ * dispatch thread only queue render_commit records; textures are uploaded,
+ * fenced and composited here, and the records are handed back through
+ * render_event once they are on screen or no longer used.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <wayland-server.h>
+#include <presentation-time-server-protocol.h>
+#include "util_egl.h"
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <GLES3/gl3.h>
+#include "util_render2d.h"
+#include "util_log.h"
+#include "compositor.h"
+
+#define NSEC_PER_MSEC 1000000ULL
+#define ACQUIRE_WAIT_MSEC 100 /* CPU wait without EGL_KHR_wait_sync */
+
+typedef enum { TEX_FREE, TEX_WRITING, TEX_COMPLETE } TexStatus;
+
+static PFNGLEGLIMAGETARGETTEXTURE2DOESPROC glEGLImageTargetTexture2DOES;
+static PFNEGLDESTROYIMAGEKHRPROC eglDestroyImageKHR;
+static PFNEGLCREATESYNCKHRPROC eglCreateSyncKHR;
+static PFNEGLDESTROYSYNCKHRPROC eglDestroySyncKHR;
+static PFNEGLDUPNATIVEFENCEFDANDROIDPROC eglDupNativeFenceFDANDROID;
+static PFNEGLWAITSYNCKHRPROC eglWaitSyncKHR;
+static bool s_native_fence = false;
+static bool s_unpack_subimage = false; /* GL_UNPACK_ROW_LENGTH */
+static bool s_tex_storage = false; /* glTexStorage2D */
+static bool s_tex_storage_bgra = false; /* ... with GL_BGRA8_EXT */
+static bool s_tex_rgb10_a2 = false; /* GL_UNSIGNED_INT_2_10_10_10_REV */
+static enum {
+	YUV_COLOR_AUTO,
+	YUV_COLOR_BT601,
+	YUV_COLOR_BT709,
+} s_yuv_color = YUV_COLOR_AUTO;
+static bool s_yuv_full_range = false;
+static bool s_thread_started = false;
+
+/*--------------------------------------------------------------------------- *
+ *  render_commit
+ *--------------------------------------------------------------------------- */
+render_commit *render_commit_create(render_commit_type type,
+				    compositor_surface *csfc)
+{
+	render_commit *rc = calloc(sizeof(*rc), 1);
+	if (rc == NULL) {
+		ELOG("%s\n", __FUNCTION__);
+		return NULL;
+	}
+
+	rc->type = type;
+	rc->csfc = csfc;
+	rc->egl_image = EGL_NO_IMAGE_KHR;
+	rc->acquire_fd = -1;
+	wl_list_init(&rc->acquire_link);
+	rc->release.type = RENDER_EVENT_RELEASE;
+	rc->release.commit = rc;
+	rc->supersede.type = RENDER_EVENT_SUPERSEDE;
+	rc->supersede.commit = rc;
+	wl_list_init(&rc->frame_callback_list);
+	wl_list_init(&rc->feedback_list);
+	wl_list_init(&rc->done_link);
+	wl_list_init(&rc->present_link);
+	rc->retire.type = RENDER_EVENT_RETIRE;
+	rc->retire.commit = rc;
+	return rc;
+}
+
+/* dispatch thread only: the shm pool is not thread safe */
+void render_commit_free(render_commit *rc)
+{
+	if (rc->shm_buffer)
+		wl_shm_buffer_unref(rc->shm_buffer);
+	if (rc->shm_pool)
+		wl_shm_pool_unref(rc->shm_pool);
+	if (rc->staging)
+		copy_pool_put_staging(rc->staging, rc->staging_size);
+	for (int i = 0; i < rc->scanout.plane_num; i++)
+		close(rc->scanout.fd[i]);
+	linux_drm_syncobj_commit_free(rc);
+	free(rc);
+}
+
+void render_submit(compositor *compositor, render_commit *rc)
+{
+	render_queue_push(&compositor->render.commit_queue, &rc->node);
+}
+
+static void render_send_event(compositor *compositor, render_event *ev)
+{
+	render_queue_push(&compositor->render.event_queue, &ev->node);
+}
+
+static int export_native_fence(EGLDisplay dpy);
+
+/*
+ * Explicit sync: the release point signals once the GPU has finished
+ * everything issued so far, the last sampling of the buffer included.
+ */
+static void render_signal_release(compositor *compositor, render_commit *rc)
+{
+	int fd = -1;
+
+	if (s_native_fence)
+		fd = export_native_fence(compositor->egl_display);
+	if (fd < 0)
+		glFinish();
+	linux_drm_syncobj_signal(&rc->release_point, fd);
+	if (fd >= 0)
+		close(fd);
+}
+
+/* a commit waiting for its flip is retired once the frame is presented */
+static void render_retire(compositor *compositor, render_commit *rc)
+{
+	if (rc->copying || rc->scanout_busy || !wl_list_empty(&rc->done_link) ||
+	    !wl_list_empty(&rc->present_link)) {
+		rc->retire_deferred = true;
+		return;
+	}
+	if (rc->egl_image != EGL_NO_IMAGE_KHR && !rc->egl_image_cached) {
+		eglDestroyImageKHR(compositor->egl_display, rc->egl_image);
+		rc->egl_image = EGL_NO_IMAGE_KHR;
+	}
+	if (rc->release_point.timeline)
+		render_signal_release(compositor, rc);
+	render_send_event(compositor, &rc->retire);
+}
+
+/*
+ * Frame callbacks are answered by the next presented output frame. The
+ * callback list belongs to the dispatch thread and may still receive the
+ * callbacks of superseded commits, so every commit is queued.
+ */
+static void render_queue_frame_done(compositor *compositor, render_commit *rc)
+{
+	if (wl_list_empty(&rc->done_link))
+		wl_list_insert(compositor->render.done_list.prev,
+			       &rc->done_link);
+	repaint_schedule(compositor);
+}
+
+static void render_frame_release(compositor *compositor, render_commit *rc)
+{
+	if (rc->retire_deferred)
+		render_retire(compositor, rc);
+}
+
+static bool render_scanout_pending(render_context *render, render_commit *rc)
+{
+	for (int i = 0; i < render->scanout_pending_num; i++) {
+		if (render->scanout_pending[i] == rc)
+			return true;
+	}
+	return false;
+}
+
+/* read by the display since the last flip, directly from its buffer */
+static bool render_scanout_front(render_context *render, render_commit *rc)
+{
+	for (int i = 0; i < render->scanout_front_num; i++) {
+		if (render->scanout_front[i] == rc)
+			return true;
+	}
+	return false;
+}
+
+/* the commit is read by the display from the pending flip on */
+static void render_scanout_hold(render_context *render, render_commit *rc)
+{
+	rc->scanout_busy = true;
+	if (!render_scanout_pending(render, rc))
+		render->scanout_pending[render->scanout_pending_num++] = rc;
+}
+
+/*
+ * The flip carrying the pending commits was not done: those not on screen
+ * already are no longer read by the display.
+ */
+static void render_scanout_drop_pending(compositor *compositor)
+{
+	render_context *render = &compositor->render;
+
+	for (int i = 0; i < render->scanout_pending_num; i++) {
+		render_commit *rc = render->scanout_pending[i];
+
+		if (render_scanout_front(render, rc))
+			continue;
+		rc->scanout_busy = false;
+		if (rc->retire_deferred)
+			render_retire(compositor, rc);
+	}
+	render->scanout_pending_num = 0;
+}
+
+/*
+ * The display was busy and nothing was flipped: the commits of the frame
+ * are presented by the next one, the frame callbacks stay queued for it.
+ */
+static void render_frame_drop(compositor *compositor)
+{
+	render_context *render = &compositor->render;
+	render_commit *rc, *tmp;
+
+	render_scanout_drop_pending(compositor);
+	wl_list_for_each_safe(rc, tmp, &render->present_list, present_link)
+	{
+		wl_list_remove(&rc->present_link);
+		wl_list_init(&rc->present_link);
+		if (wl_list_empty(&rc->done_link))
+			render_frame_release(compositor, rc);
+	}
+	repaint_schedule(compositor);
+}
+
+/*
+ * Called on every completed page flip before render_frame_presented(). A
+ * scanned out commit is read by the display until the next flip, whatever
+ * that flip shows.
+ */
+void render_scanout_flipped(compositor *compositor)
+{
+	render_context *render = &compositor->render;
+
+	for (int i = 0; i < render->scanout_front_num; i++) {
+		render_commit *old = render->scanout_front[i];
+
+		if (render_scanout_pending(render, old))
+			continue;
+		old->scanout_busy = false;
+		if (old->retire_deferred)
+			render_retire(compositor, old);
+	}
+	memcpy(render->scanout_front, render->scanout_pending,
+	       render->scanout_pending_num * sizeof(render->scanout_front[0]));
+	render->scanout_front_num = render->scanout_pending_num;
+	render->scanout_pending_num = 0;
+}
+
+/*
+ * The repainted frame reached the screen at nsec (CLOCK_MONOTONIC). seq
+ * is the vblank counter of the flip, or 0 when the window system does not
+ * report one. The frame callbacks queued before the repaint and the
+ * feedback of the commits drawn for the first time are handed over in a
+ * single event.
+ */
+void render_frame_presented(compositor *compositor, uint64_t nsec,
+			    uint64_t seq, uint32_t flags)
+{
+	render_context *render = &compositor->render;
+	render_commit *rc, *tmp;
+	int num = wl_list_length(&render->done_flip_list) +
+		  wl_list_length(&render->present_list);
+
+	if (num == 0)
+		return;
+
+	render_frame *frame =
+		calloc(1, sizeof(*frame) + num * sizeof(frame->entries[0]));
+	if (frame == NULL)
+		ELOG("%s\n", __FUNCTION__);
+
+	wl_list_for_each(rc, &render->done_flip_list, done_link)
+	{
+		if (frame) {
+			frame->entries[frame->entry_num].commit = rc;
+			frame->entries[frame->entry_num++].presented = false;
+		}
+	}
+	wl_list_for_each(rc, &render->present_list, present_link)
+	{
+		rc->present_nsec = nsec;
+		rc->present_seq = seq;
+		rc->present_refresh_nsec = render->repaint.refresh_nsec;
+		rc->present_flags = flags;
+		if (render_scanout_front(render, rc))
+			rc->present_flags |=
+				WP_PRESENTATION_FEEDBACK_KIND_ZERO_COPY;
+		if (frame) {
+			frame->entries[frame->entry_num].commit = rc;
+			frame->entries[frame->entry_num++].presented = true;
+		}
+	}
+	if (frame) {
+		frame->event.type = RENDER_EVENT_FRAME;
+		frame->event.commit = NULL;
+		frame->time_msec = nsec / NSEC_PER_MSEC;
+		render_send_event(compositor, &frame->event);
+	}
+
+	/* deferred retires must follow the frame event */
+	wl_list_for_each_safe(rc, tmp, &render->done_flip_list, done_link)
+	{
+		wl_list_remove(&rc->done_link);
+		wl_list_init(&rc->done_link);
+		if (wl_list_empty(&rc->present_link))
+			render_frame_release(compositor, rc);
+	}
+	wl_list_for_each_safe(rc, tmp, &render->present_list, present_link)
+	{
+		wl_list_remove(&rc->present_link);
+		wl_list_init(&rc->present_link);
+		if (wl_list_empty(&rc->done_link))
+			render_frame_release(compositor, rc);
+	}
+}
+
+/*--------------------------------------------------------------------------- *
+ *  draw table
+ *--------------------------------------------------------------------------- */
+/* publish the displayed slot of a mapped surface to the repaint */
+static void render_surface_update_draw(compositor_surface *csfc)
+{
+	if (csfc->draw_index < 0)
+		return;
+
+	render_draw *draw = &csfc->compositor->render.draws[csfc->draw_index];
+	if (csfc->displayed_slot < 0) {
+		draw->texid[0] = 0;
+		draw->commit = NULL;
+		return;
+	}
+	tex_slot *slot = &csfc->slots[csfc->displayed_slot];
+	memcpy(draw->texid, slot->texid, sizeof(draw->texid));
+	draw->swizzle = slot->tex_swizzle;
+	draw->yuv = slot->tex_yuv;
+	draw->commit = slot->commit;
+	draw->width = slot->commit->width;
+	draw->height = slot->commit->height;
+}
+
+static void render_surface_unmap(compositor_surface *csfc)
+{
+	render_context *render = &csfc->compositor->render;
+	int index = csfc->draw_index;
+
+	if (index < 0)
+		return;
+	memmove(&render->draws[index], &render->draws[index + 1],
+		(render->draw_num - index - 1) * sizeof(render->draws[0]));
+	render->draw_num--;
+	for (int i = index; i < render->draw_num; i++)
+		render->draws[i].csfc->draw_index = i;
+	csfc->draw_index = -1;
+}
+
+/* mapping again raises the surface to the top */
+static int render_surface_map(compositor_surface *csfc)
+{
+	render_context *render = &csfc->compositor->render;
+
+	render_surface_unmap(csfc);
+	if (render->draw_num == render->draw_cap) {
+		int cap = render->draw_cap ? render->draw_cap * 2 : 16;
+		render_draw *draws =
+			realloc(render->draws, cap * sizeof(render->draws[0]));
+		if (draws == NULL) {
+			ELOG("%s\n", __FUNCTION__);
+			return -1;
+		}
+		render->draws = draws;
+		render->draw_cap = cap;
+	}
+	csfc->draw_index = render->draw_num++;
+	render->draws[csfc->draw_index].csfc = csfc;
+	render_surface_update_draw(csfc);
+	return 0;
+}
+
+/*--------------------------------------------------------------------------- *
+ *  upload fence
+ *--------------------------------------------------------------------------- */
+static void render_surface_flush(compositor_surface *csfc);
+
+/*
+ * With several slots in flight the fences may be reported out of order;
+ * only an upload newer than the displayed one takes its place.
+ */
+static void complete_tex_upload(tex_slot *slot)
+{
+	compositor_surface *csfc = slot->csfc;
+	compositor *compositor = csfc->compositor;
+	render_commit *rc = slot->commit;
+
+	slot->status = TEX_COMPLETE;
+	timeline_stamp(rc->timeline_id, TIMELINE_FENCE);
+	render_queue_frame_done(compositor, rc);
+
+	if (slot->replaced) {
+		/* single slot: the texture already holds the new content */
+		render_retire(compositor, slot->replaced);
+		slot->replaced = NULL;
+	} else if (csfc->displayed_slot >= 0) {
+		tex_slot *shown = &csfc->slots[csfc->displayed_slot];
+		if (shown->seq > slot->seq) {
+			render_retire(compositor, rc);
+			slot->commit = NULL;
+			slot->status = TEX_FREE;
+			render_surface_flush(csfc);
+			return;
+		}
+		/* the previous content is no longer sampled from */
+		render_retire(compositor, shown->commit);
+		shown->commit = NULL;
+		shown->status = TEX_FREE;
+	}
+	csfc->displayed_slot = slot - csfc->slots;
+	render_surface_update_draw(csfc);
+	repaint_schedule(compositor);
+
+	render_surface_flush(csfc);
+}
+
+static void disarm_upload_fence(tex_slot *slot)
+{
+	if (slot->fence_source) {
+		wl_event_source_remove(slot->fence_source);
+		slot->fence_source = NULL;
+	}
+	if (slot->fence_fd >= 0) {
+		close(slot->fence_fd);
+		slot->fence_fd = -1;
+	}
+	if (slot->glsyncobj_tex) {
+		glDeleteSync(slot->glsyncobj_tex);
+		slot->glsyncobj_tex = NULL;
+		wl_list_remove(&slot->upload_link);
+		wl_list_init(&slot->upload_link);
+	}
+}
+
+/* a sync file becomes readable once the fence has signaled */
+static int upload_fence_signaled(int fd, uint32_t mask, void *data)
+{
+	tex_slot *slot = data;
+
+	disarm_upload_fence(slot);
+	complete_tex_upload(slot);
+	return 0;
+}
+
+static int export_native_fence(EGLDisplay dpy)
+{
+	EGLSyncKHR sync =
+		eglCreateSyncKHR(dpy, EGL_SYNC_NATIVE_FENCE_ANDROID, NULL);
+	if (sync == EGL_NO_SYNC_KHR) {
+		return -1;
+	}
+
+	/* the fence fd is only materialized once the commands are flushed */
+	glFlush();
+	int fd = eglDupNativeFenceFDANDROID(dpy, sync);
+	eglDestroySyncKHR(dpy, sync);
+	return fd;
+}
+
+static void arm_upload_fence(tex_slot *slot)
+{
+	compositor *compositor = slot->csfc->compositor;
+	render_context *render = &compositor->render;
+
+	slot->status = TEX_WRITING;
+
+	if (s_native_fence) {
+		int fd = export_native_fence(compositor->egl_display);
+		if (fd >= 0) {
+			slot->fence_fd = fd;
+			slot->fence_source = wl_event_loop_add_fd(
+				render->loop, fd, WL_EVENT_READABLE,
+				upload_fence_signaled, slot);
+			if (slot->fence_source)
+				return;
+			close(fd);
+			slot->fence_fd = -1;
+		}
+		WLOG("%s native fence export failed, fall back to polling\n",
+		     __FUNCTION__);
+		s_native_fence = false;
+	}
+
+	slot->glsyncobj_tex = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	glFlush();
+	wl_list_insert(render->upload_list.prev, &slot->upload_link);
+	wl_event_source_timer_update(render->fence_timer, 1);
+}
+
+/* fallback for drivers without EGL_ANDROID_native_fence_sync */
+static int poll_upload_fences(void *data)
+{
+	compositor *compositor = data;
+	render_context *render = &compositor->render;
+	tex_slot *slot, *tmp;
+
+	wl_list_for_each_safe(slot, tmp, &render->upload_list, upload_link)
+	{
+		GLenum result = glClientWaitSync(slot->glsyncobj_tex,
+						 GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+		if (result == GL_ALREADY_SIGNALED ||
+		    result == GL_CONDITION_SATISFIED) {
+			disarm_upload_fence(slot);
+			complete_tex_upload(slot);
+		}
+	}
+	if (!wl_list_empty(&render->upload_list))
+		wl_event_source_timer_update(render->fence_timer, 1);
+	return 0;
+}
+
+/*--------------------------------------------------------------------------- *
+ *  texture upload
+ *--------------------------------------------------------------------------- */
+static void tex_plane_init_texture(GLuint *texid)
+{
+	if (*texid != 0)
+		return;
+	glGenTextures(1, texid);
+	glBindTexture(GL_TEXTURE_2D, *texid);
+	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
+static void tex_slot_init_texture(tex_slot *slot)
+{
+	tex_plane_init_texture(&slot->texid[0]);
+}
+
+typedef struct shm_gl_format {
+	uint32_t shm_format;
+	int bpp;
+	GLenum format;
+	GLenum type;
+	GLenum sized_format; /* immutable storage */
+	const char *swizzle; /* see draw_2d_texture_swizzle() */
+} shm_gl_format;
+
+/*
+ * The buffer bytes are uploaded as they are, in a GL format of the same
+ * layout, and the channels are put in place by the sampling shader.
+ * Formats without a GL layout are converted into ARGB8888 on the CPU,
+ * see pixel_convert.c.
+ */
+static const shm_gl_format s_shm_formats[] = {
+	{ WL_SHM_FORMAT_ARGB8888, 4, GL_BGRA_EXT, GL_UNSIGNED_BYTE,
+	  GL_BGRA8_EXT, "rgba" },
+	{ WL_SHM_FORMAT_XRGB8888, 4, GL_BGRA_EXT, GL_UNSIGNED_BYTE,
+	  GL_BGRA8_EXT, "rgb1" },
+	{ WL_SHM_FORMAT_ABGR8888, 4, GL_RGBA, GL_UNSIGNED_BYTE, GL_RGBA8,
+	  "rgba" },
+	{ WL_SHM_FORMAT_XBGR8888, 4, GL_RGBA, GL_UNSIGNED_BYTE, GL_RGBA8,
+	  "rgb1" },
+	{ WL_SHM_FORMAT_RGB888, 3, GL_RGB, GL_UNSIGNED_BYTE, GL_RGB8,
+	  "bgra" },
+	{ WL_SHM_FORMAT_BGR888, 3, GL_RGB, GL_UNSIGNED_BYTE, GL_RGB8,
+	  "rgba" },
+	{ WL_SHM_FORMAT_RGB565, 2, GL_RGB, GL_UNSIGNED_SHORT_5_6_5,
+	  GL_RGB565, "rgba" },
+	{ WL_SHM_FORMAT_BGR565, 2, GL_RGB, GL_UNSIGNED_SHORT_5_6_5,
+	  GL_RGB565, "bgra" },
+	/* 4_4_4_4 and 5_5_5_1 take red from the most significant bits */
+	{ WL_SHM_FORMAT_RGBA4444, 2, GL_RGBA, GL_UNSIGNED_SHORT_4_4_4_4,
+	  GL_RGBA4, "rgba" },
+	{ WL_SHM_FORMAT_RGBX4444, 2, GL_RGBA, GL_UNSIGNED_SHORT_4_4_4_4,
+	  GL_RGBA4, "rgb1" },
+	{ WL_SHM_FORMAT_BGRA4444, 2, GL_RGBA, GL_UNSIGNED_SHORT_4_4_4_4,
+	  GL_RGBA4, "bgra" },
+	{ WL_SHM_FORMAT_BGRX4444, 2, GL_RGBA, GL_UNSIGNED_SHORT_4_4_4_4,
+	  GL_RGBA4, "bgr1" },
+	{ WL_SHM_FORMAT_ARGB4444, 2, GL_RGBA, GL_UNSIGNED_SHORT_4_4_4_4,
+	  GL_RGBA4, "gbar" },
+	{ WL_SHM_FORMAT_XRGB4444, 2, GL_RGBA, GL_UNSIGNED_SHORT_4_4_4_4,
+	  GL_RGBA4, "gba1" },
+	{ WL_SHM_FORMAT_ABGR4444, 2, GL_RGBA, GL_UNSIGNED_SHORT_4_4_4_4,
+	  GL_RGBA4, "abgr" },
+	{ WL_SHM_FORMAT_XBGR4444, 2, GL_RGBA, GL_UNSIGNED_SHORT_4_4_4_4,
+	  GL_RGBA4, "abg1" },
+	{ WL_SHM_FORMAT_RGBA5551, 2, GL_RGBA, GL_UNSIGNED_SHORT_5_5_5_1,
+	  GL_RGB5_A1, "rgba" },
+	{ WL_SHM_FORMAT_RGBX5551, 2, GL_RGBA, GL_UNSIGNED_SHORT_5_5_5_1,
+	  GL_RGB5_A1, "rgb1" },
+	{ WL_SHM_FORMAT_BGRA5551, 2, GL_RGBA, GL_UNSIGNED_SHORT_5_5_5_1,
+	  GL_RGB5_A1, "bgra" },
+	{ WL_SHM_FORMAT_BGRX5551, 2, GL_RGBA, GL_UNSIGNED_SHORT_5_5_5_1,
+	  GL_RGB5_A1, "bgr1" },
+	/* 2_10_10_10_REV takes red from the least significant bits */
+	{ WL_SHM_FORMAT_ARGB2101010, 4, GL_RGBA,
+	  GL_UNSIGNED_INT_2_10_10_10_REV, GL_RGB10_A2, "bgra" },
+	{ WL_SHM_FORMAT_XRGB2101010, 4, GL_RGBA,
+	  GL_UNSIGNED_INT_2_10_10_10_REV, GL_RGB10_A2, "bgr1" },
+	{ WL_SHM_FORMAT_ABGR2101010, 4, GL_RGBA,
+	  GL_UNSIGNED_INT_2_10_10_10_REV, GL_RGB10_A2, "rgba" },
+	{ WL_SHM_FORMAT_XBGR2101010, 4, GL_RGBA,
+	  GL_UNSIGNED_INT_2_10_10_10_REV, GL_RGB10_A2, "rgb1" },
+};
+
+static const shm_gl_format *shm_gl_format_lookup(uint32_t shm_format)
+{
+	for (size_t i = 0; i < sizeof(s_shm_formats) / sizeof(s_shm_formats[0]);
+	     i++) {
+		const shm_gl_format *f = &s_shm_formats[i];
+
+		if (f->shm_format != shm_format)
+			continue;
+		if (f->type == GL_UNSIGNED_INT_2_10_10_10_REV &&
+		    !s_tex_rgb10_a2)
+			return NULL;
+		return f;
+	}
+	return NULL;
+}
+
+typedef struct shm_yuv_plane {
+	int hsub; /* subsampling */
+	int vsub;
+	int bpp; /* bytes per texel */
+	GLenum format;
+	int stride_div; /* of the buffer stride */
+	bool alias; /* another view of the previous plane */
+} shm_yuv_plane;
+
+typedef struct shm_yuv_format {
+	uint32_t shm_format;
+	int yuv; /* RENDER2D_YUV_* layout */
+	int plane_num;
+	shm_yuv_plane planes[TEX_PLANE_MAX];
+} shm_yuv_format;
+
+/*
+ * Every plane is a texture of its own, converted to RGB when sampled.
+ * wl_shm describes the luma plane only; the chroma planes follow it as
+ * other compositors lay them out. YUYV is sampled twice: the luma at full
+ * width, the chroma pairs as RGBA texels at half width.
+ */
+static const shm_yuv_format s_shm_yuv_formats[] = {
+	{ WL_SHM_FORMAT_NV12, RENDER2D_YUV_Y_UV, 2,
+	  { { 1, 1, 1, GL_LUMINANCE, 1, false },
+	    { 2, 2, 2, GL_LUMINANCE_ALPHA, 1, false } } },
+	{ WL_SHM_FORMAT_NV21, RENDER2D_YUV_Y_UV | RENDER2D_YUV_SWAP_UV, 2,
+	  { { 1, 1, 1, GL_LUMINANCE, 1, false },
+	    { 2, 2, 2, GL_LUMINANCE_ALPHA, 1, false } } },
+	{ WL_SHM_FORMAT_YUV420, RENDER2D_YUV_Y_U_V, 3,
+	  { { 1, 1, 1, GL_LUMINANCE, 1, false },
+	    { 2, 2, 1, GL_LUMINANCE, 2, false },
+	    { 2, 2, 1, GL_LUMINANCE, 2, false } } },
+	{ WL_SHM_FORMAT_YUYV, RENDER2D_YUV_Y_XUXV, 2,
+	  { { 1, 1, 2, GL_LUMINANCE_ALPHA, 1, false },
+	    { 2, 1, 4, GL_RGBA, 1, true } } },
+};
+
+static const shm_yuv_format *shm_yuv_format_lookup(uint32_t shm_format)
+{
+	for (size_t i = 0;
+	     i < sizeof(s_shm_yuv_formats) / sizeof(s_shm_yuv_formats[0]);
+	     i++) {
+		if (s_shm_yuv_formats[i].shm_format == shm_format)
+			return &s_shm_yuv_formats[i];
+	}
+	return NULL;
+}
+
+static int32_t subsample(int32_t size, int sub)
+{
+	return (size + sub - 1) / sub;
+}
+
+/* plane offsets and strides in bytes, returns the size of the buffer */
+static size_t shm_yuv_layout(const shm_yuv_format *yf, int32_t stride,
+			     int32_t height, size_t *offset, int32_t *pitch)
+{
+	size_t end = 0;
+
+	for (int i = 0; i < yf->plane_num; i++) {
+		const shm_yuv_plane *p = &yf->planes[i];
+
+		offset[i] = p->alias ? offset[i - 1] : end;
+		pitch[i] = stride / p->stride_div;
+		if (offset[i] + (size_t)pitch[i] * subsample(height, p->vsub) >
+		    end)
+			end = offset[i] +
+			      (size_t)pitch[i] * subsample(height, p->vsub);
+	}
+	return end;
+}
+
+/* read by the copy workers: a format GL takes is copied unconverted */
+bool render_shm_format_native(uint32_t shm_format)
+{
+	return shm_gl_format_lookup(shm_format) != NULL ||
+	       shm_yuv_format_lookup(shm_format) != NULL;
+}
+
+size_t render_shm_buffer_size(uint32_t shm_format, int32_t stride,
+			      int32_t height)
+{
+	const shm_yuv_format *yf = shm_yuv_format_lookup(shm_format);
+	size_t offset[TEX_PLANE_MAX];
+	int32_t pitch[TEX_PLANE_MAX];
+
+	if (yf)
+		return shm_yuv_layout(yf, stride, height, offset, pitch);
+	return (size_t)stride * height;
+}
+
+/* the mandatory formats are advertised by wl_display_init_shm() */
+void render_add_shm_formats(struct wl_display *display)
+{
+	for (size_t i = 0; i < sizeof(s_shm_formats) / sizeof(s_shm_formats[0]);
+	     i++) {
+		uint32_t format = s_shm_formats[i].shm_format;
+
+		if (format != WL_SHM_FORMAT_XRGB8888 &&
+		    format != WL_SHM_FORMAT_ARGB8888 &&
+		    render_shm_format_native(format))
+			wl_display_add_shm_format(display, format);
+	}
+	for (size_t i = 0;
+	     i < sizeof(s_shm_yuv_formats) / sizeof(s_shm_yuv_formats[0]);
+	     i++)
+		wl_display_add_shm_format(display,
+					  s_shm_yuv_formats[i].shm_format);
+}
+
+/*
+ * Without a color space in wl_shm, HD content is taken as BT.709 and SD
+ * content as BT.601, both in video range unless configured otherwise.
+ */
+static int yuv_color_flags(int32_t height)
+{
+	int flags = 0;
+
+	if (s_yuv_color == YUV_COLOR_BT709 ||
+	    (s_yuv_color == YUV_COLOR_AUTO && height >= 720))
+		flags |= RENDER2D_YUV_BT709;
+	if (s_yuv_full_range)
+		flags |= RENDER2D_YUV_FULL_RANGE;
+	return flags;
+}
+
+/*
+ * Immutable storage cannot be respecified: a new size or format, or an
+ * EGLImage, needs a new texture object.
+ */
+static void tex_slot_reset_texture(tex_slot *slot)
+{
+	if (slot->tex_immutable) {
+		glDeleteTextures(1, &slot->texid[0]);
+		slot->texid[0] = 0;
+		slot->tex_immutable = false;
+		tex_slot_init_texture(slot);
+	}
+	/* chroma planes are only kept while the content is YUV */
+	for (int i = 1; i < TEX_PLANE_MAX; i++) {
+		if (slot->texid[i] != 0) {
+			glDeleteTextures(1, &slot->texid[i]);
+			slot->texid[i] = 0;
+		}
+	}
+	slot->tex_yuv = 0;
+	slot->tex_w = 0;
+	slot->tex_h = 0;
+	slot->tex_format = 0;
+	slot->tex_swizzle = NULL;
+}
+
+/* allocated once per size and format, commits only update the content */
+static void tex_slot_alloc_storage(tex_slot *slot, render_commit *rc,
+				   const shm_gl_format *f)
+{
+	bool immutable = s_tex_storage &&
+			 (f->sized_format != GL_BGRA8_EXT || s_tex_storage_bgra);
+
+	tex_slot_reset_texture(slot);
+	if (immutable) {
+		glTexStorage2D(GL_TEXTURE_2D, 1, f->sized_format, rc->width,
+			       rc->height);
+		slot->tex_immutable = true;
+	} else {
+		glTexImage2D(GL_TEXTURE_2D, 0, f->format, rc->width, rc->height,
+			     0, f->format, f->type, NULL);
+	}
+	slot->tex_w = rc->width;
+	slot->tex_h = rc->height;
+	slot->tex_format = rc->shm_format;
+	slot->tex_swizzle = f->swizzle;
+}
+
+/*
+ * Rows are addressed through GL_UNPACK_ROW_LENGTH so that the stride
+ * padding is never uploaded. Without GL_EXT_unpack_subimage, or with a
+ * stride that is not a whole number of pixels, a padded rectangle is sent
+ * row by row.
+ */
+static void upload_rect(const uint8_t *base, int32_t stride, int bpp,
+			GLenum format, GLenum type, const damage_rect *r,
+			bool row_length)
+{
+	const uint8_t *data = base + (size_t)r->y * stride + (size_t)r->x * bpp;
+
+	if (row_length) {
+		glTexSubImage2D(GL_TEXTURE_2D, 0, r->x, r->y, r->w, r->h,
+				format, type, data);
+	} else if (r->w * bpp == stride) {
+		glTexSubImage2D(GL_TEXTURE_2D, 0, r->x, r->y, r->w, r->h,
+				format, type, data);
+	} else {
+		for (int32_t y = 0; y < r->h; y++) {
+			glTexSubImage2D(GL_TEXTURE_2D, 0, r->x, r->y + y, r->w,
+					1, format, type,
+					data + (size_t)y * stride);
+		}
+	}
+}
+
+static void upload_shm_rect(render_commit *rc, const damage_rect *r,
+			    const shm_gl_format *f, bool row_length)
+{
+	upload_rect(rc->shm_data, rc->shm_stride, f->bpp, f->format, f->type,
+		    r, row_length);
+}
+
+/* converted rows are tightly packed into a scratch buffer first */
+static void upload_shm_rect_converted(render_context *render,
+				      render_commit *rc, const damage_rect *r,
+				      const pixel_converter *conv)
+{
+	size_t pitch = (size_t)r->w * 4;
+	size_t size = pitch * r->h;
+
+	if (render->convert_size < size) {
+		uint8_t *buf = realloc(render->convert_buf, size);
+		if (buf == NULL) {
+			ELOG("%s\n", __FUNCTION__);
+			return;
+		}
+		render->convert_buf = buf;
+		render->convert_size = size;
+	}
+
+	const uint8_t *src = (const uint8_t *)rc->shm_data +
+			     (size_t)r->y * rc->shm_stride +
+			     (size_t)r->x * conv->bpp;
+	for (int32_t y = 0; y < r->h; y++)
+		conv->convert(render->convert_buf + y * pitch,
+			      src + (size_t)y * rc->shm_stride, r->w);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, r->x, r->y, r->w, r->h, GL_BGRA_EXT,
+			GL_UNSIGNED_BYTE, render->convert_buf);
+}
+
+/*
+ * Copy the rectangles tightly packed into the next buffer of the ring and
+ * let the driver pipeline the transfer into the texture. Returns -1 when
+ * the buffer cannot be mapped, the caller then uploads from client memory.
+ */
+static int upload_shm_pbo(render_context *render, render_commit *rc,
+			  const damage *dmg, const shm_gl_format *f,
+			  const pixel_converter *conv)
+{
+	int src_bpp = conv ? conv->bpp : f->bpp;
+	damage_rect all = { 0, 0, rc->width, rc->height };
+	const damage_rect *rects = dmg->full ? &all : dmg->rects;
+	int num = dmg->full ? 1 : dmg->num;
+	size_t size = 0;
+
+	/* rows are tightly packed, GL_UNPACK_ALIGNMENT is 1 */
+	for (int i = 0; i < num; i++)
+		size += (size_t)rects[i].w * f->bpp * rects[i].h;
+	if (size == 0)
+		return 0;
+
+	int index = render->pbo_next;
+	render->pbo_next = (render->pbo_next + 1) % PBO_RING_SIZE;
+	if (render->pbo[index] == 0)
+		glGenBuffers(1, &render->pbo[index]);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, render->pbo[index]);
+	if (render->pbo_size[index] < size) {
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+		render->pbo_size[index] = size;
+	}
+
+	/* invalidation lets the driver rename a buffer still being read */
+	uint8_t *dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+					GL_MAP_WRITE_BIT |
+						GL_MAP_INVALIDATE_BUFFER_BIT);
+	if (dst == NULL) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		return -1;
+	}
+
+	size_t offset = 0;
+	for (int i = 0; i < num; i++) {
+		const damage_rect *r = &rects[i];
+		const uint8_t *src = (const uint8_t *)rc->shm_data +
+				     (size_t)r->y * rc->shm_stride +
+				     (size_t)r->x * src_bpp;
+		size_t pitch = (size_t)r->w * f->bpp;
+
+		for (int32_t y = 0; y < r->h; y++) {
+			if (conv)
+				conv->convert(dst + offset + y * pitch,
+					      src + (size_t)y * rc->shm_stride,
+					      r->w);
+			else
+				memcpy(dst + offset + y * pitch,
+				       src + (size_t)y * rc->shm_stride, pitch);
+		}
+		offset += pitch * r->h;
+	}
+	if (glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) == GL_FALSE) {
+		/* the content was lost while mapped */
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		return -1;
+	}
+
+	offset = 0;
+	for (int i = 0; i < num; i++) {
+		const damage_rect *r = &rects[i];
+		size_t pitch = (size_t)r->w * f->bpp;
+
+		glTexSubImage2D(GL_TEXTURE_2D, 0, r->x, r->y, r->w, r->h,
+				f->format, f->type, (const void *)offset);
+		offset += pitch * r->h;
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	return 0;
+}
+
+/* planes are mutable: sized luminance formats need GL_EXT_texture_storage */
+static void tex_slot_alloc_yuv_storage(tex_slot *slot, render_commit *rc,
+				       const shm_yuv_format *yf)
+{
+	tex_slot_reset_texture(slot);
+	for (int i = 0; i < yf->plane_num; i++) {
+		const shm_yuv_plane *p = &yf->planes[i];
+
+		tex_plane_init_texture(&slot->texid[i]);
+		glBindTexture(GL_TEXTURE_2D, slot->texid[i]);
+		glTexImage2D(GL_TEXTURE_2D, 0, p->format,
+			     subsample(rc->width, p->hsub),
+			     subsample(rc->height, p->vsub), 0, p->format,
+			     GL_UNSIGNED_BYTE, NULL);
+	}
+	slot->tex_w = rc->width;
+	slot->tex_h = rc->height;
+	slot->tex_format = rc->shm_format;
+	slot->tex_swizzle = NULL;
+	slot->tex_yuv = yf->yuv | yuv_color_flags(rc->height);
+}
+
+static void upload_shm_yuv(tex_slot *slot, render_commit *rc,
+			   const damage *dmg, const shm_yuv_format *yf)
+{
+	damage_rect all = { 0, 0, rc->width, rc->height };
+	const damage_rect *rects = dmg->full ? &all : dmg->rects;
+	int num = dmg->full ? 1 : dmg->num;
+	size_t offset[TEX_PLANE_MAX];
+	int32_t pitch[TEX_PLANE_MAX];
+
+	shm_yuv_layout(yf, rc->shm_stride, rc->height, offset, pitch);
+	for (int i = 0; i < yf->plane_num; i++) {
+		const shm_yuv_plane *p = &yf->planes[i];
+		const uint8_t *base = (const uint8_t *)rc->shm_data + offset[i];
+		bool row_length = s_unpack_subimage && pitch[i] % p->bpp == 0;
+
+		glBindTexture(GL_TEXTURE_2D, slot->texid[i]);
+		if (row_length)
+			glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT,
+				      pitch[i] / p->bpp);
+		for (int j = 0; j < num; j++) {
+			const damage_rect *r = &rects[j];
+			damage_rect pr;
+
+			/* chroma texels touched by the damaged pixels */
+			pr.x = r->x / p->hsub;
+			pr.y = r->y / p->vsub;
+			pr.w = subsample(r->x + r->w, p->hsub) - pr.x;
+			pr.h = subsample(r->y + r->h, p->vsub) - pr.y;
+			upload_rect(base, pitch[i], p->bpp, p->format,
+				    GL_UNSIGNED_BYTE, &pr, row_length);
+		}
+		if (row_length)
+			glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, 0);
+	}
+}
+
+static int upload_shm(tex_slot *slot, render_commit *rc)
+{
+	render_context *render = &slot->csfc->compositor->render;
+	const shm_yuv_format *yf = shm_yuv_format_lookup(rc->shm_format);
+	const shm_gl_format *f = shm_gl_format_lookup(rc->shm_format);
+	const pixel_converter *conv = NULL;
+	damage dmg;
+
+	if (f == NULL && yf == NULL) {
+		conv = pixel_convert_lookup(rc->shm_format);
+		if (conv == NULL) {
+			WLOG("%s unknown shm buffer format: %08x\n",
+			     __FUNCTION__, rc->shm_format);
+			return -1;
+		}
+		f = shm_gl_format_lookup(WL_SHM_FORMAT_ARGB8888);
+	}
+
+	if (slot->tex_w != rc->width || slot->tex_h != rc->height ||
+	    slot->tex_format != rc->shm_format) {
+		if (yf)
+			tex_slot_alloc_yuv_storage(slot, rc, yf);
+		else
+			tex_slot_alloc_storage(slot, rc, f);
+		damage_init(&dmg);
+		damage_set_full(&dmg);
+	} else {
+		/* catch up with the commits uploaded into the other slots */
+		dmg = slot->stale;
+		damage_union(&dmg, &rc->damage);
+	}
+
+	if (yf) {
+		upload_shm_yuv(slot, rc, &dmg, yf);
+		return 0;
+	}
+
+	if (render->pbo_upload &&
+	    upload_shm_pbo(render, rc, &dmg, f, conv) == 0)
+		return 0;
+
+	if (conv) {
+		damage_rect all = { 0, 0, rc->width, rc->height };
+		const damage_rect *rects = dmg.full ? &all : dmg.rects;
+		int num = dmg.full ? 1 : dmg.num;
+
+		for (int i = 0; i < num; i++)
+			upload_shm_rect_converted(render, rc, &rects[i], conv);
+		return 0;
+	}
+
+	bool row_length = s_unpack_subimage && rc->shm_stride % f->bpp == 0;
+	if (row_length)
+		glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT,
+			      rc->shm_stride / f->bpp);
+	if (dmg.full) {
+		damage_rect all = { 0, 0, rc->width, rc->height };
+		upload_shm_rect(rc, &all, f, row_length);
+	}
+	for (int i = 0; i < dmg.num; i++)
+		upload_shm_rect(rc, &dmg.rects[i], f, row_length);
+	if (row_length)
+		glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, 0);
+	return 0;
+}
+
+/*
+ * Explicit sync: the GPU waits for the client's rendering before sampling
+ * the buffer, the render thread does not.
+ */
+static void wait_acquire_fence(EGLDisplay dpy, render_commit *rc)
+{
+	EGLint attribs[] = { EGL_SYNC_NATIVE_FENCE_FD_ANDROID, rc->acquire_fd,
+			     EGL_NONE };
+	EGLSyncKHR sync = EGL_NO_SYNC_KHR;
+
+	if (eglWaitSyncKHR)
+		sync = eglCreateSyncKHR(dpy, EGL_SYNC_NATIVE_FENCE_ANDROID,
+					attribs);
+	if (sync != EGL_NO_SYNC_KHR) {
+		/* the fd is owned by the sync object now */
+		rc->acquire_fd = -1;
+		if (eglWaitSyncKHR(dpy, sync, 0) != EGL_TRUE)
+			WLOG("%s eglWaitSyncKHR: 0x%x\n", __FUNCTION__,
+			     eglGetError());
+		eglDestroySyncKHR(dpy, sync);
+		return;
+	}
+
+	struct pollfd pfd = { .fd = rc->acquire_fd, .events = POLLIN };
+	if (poll(&pfd, 1, ACQUIRE_WAIT_MSEC) != 1)
+		WLOG("%s acquire fence not signaled\n", __FUNCTION__);
+	close(rc->acquire_fd);
+	rc->acquire_fd = -1;
+}
+
+static bool render_commit_has_content(render_commit *rc)
+{
+	return rc->shm_data != NULL || rc->egl_image != EGL_NO_IMAGE_KHR;
+}
+
+/*
+ * A commit not staged by the copy workers is read from client memory,
+ * under the SIGBUS guard of the render thread. The staged check leaves
+ * rc->shm_buffer alone, the dispatch thread drops it on release.
+ */
+static void shm_begin_access(render_commit *rc)
+{
+	if (rc->staging == NULL)
+		wl_shm_buffer_begin_access(rc->shm_buffer);
+}
+
+static void shm_end_access(render_commit *rc)
+{
+	if (rc->staging == NULL)
+		wl_shm_buffer_end_access(rc->shm_buffer);
+}
+
+static int upload_commit(tex_slot *slot, render_commit *rc)
+{
+	int ret = -1;
+
+	tex_slot_init_texture(slot);
+	glBindTexture(GL_TEXTURE_2D, slot->texid[0]);
+	if (rc->shm_data) {
+		shm_begin_access(rc);
+		ret = upload_shm(slot, rc);
+		shm_end_access(rc);
+	} else {
+		tex_slot_reset_texture(slot);
+		if (rc->acquire_fd >= 0)
+			wait_acquire_fence(slot->csfc->compositor->egl_display,
+					   rc);
+		glEGLImageTargetTexture2DOES(GL_TEXTURE_2D, rc->egl_image);
+		ret = 0;
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	if (ret == -1 || rc->shm_data == NULL)
+		tile_grid_reset(&slot->csfc->tiles);
+	if (ret == 0) {
+		compositor_surface *csfc = slot->csfc;
+
+		/* a single slot written in place may have a new texture */
+		if (slot - csfc->slots == csfc->displayed_slot)
+			render_surface_update_draw(csfc);
+
+		damage_init(&slot->stale);
+		for (int i = 0; i < csfc->slot_num; i++) {
+			if (&csfc->slots[i] != slot)
+				damage_union(&csfc->slots[i].stale,
+					     &rc->damage);
+		}
+	}
+	return ret;
+}
+
+/*
+ * With tile hashing, shrink the damage of an shm commit to the tiles that
+ * changed since the last upload. Returns false when nothing changed.
+ */
+static bool render_commit_refine_damage(compositor_surface *csfc,
+					render_commit *rc)
+{
+	const shm_gl_format *f = shm_gl_format_lookup(rc->shm_format);
+	const pixel_converter *conv = pixel_convert_lookup(rc->shm_format);
+	int32_t bpp = f ? f->bpp : conv ? conv->bpp : 0;
+
+	if (!csfc->compositor->render.tile_hash || rc->shm_data == NULL)
+		return true;
+	if (bpp == 0) {
+		/* YUV planes are uploaded as they are */
+		tile_grid_reset(&csfc->tiles);
+		return true;
+	}
+	shm_begin_access(rc);
+	bool changed = tile_grid_refine(&csfc->tiles, rc->shm_data,
+					rc->shm_stride, bpp, rc->shm_format,
+					rc->width, rc->height, &rc->damage);
+	shm_end_access(rc);
+	return changed;
+}
+
+/*
+ * The frame callbacks move to the newer commit right away: the retire of
+ * the replaced commit may be deferred by its copy, until after the newer
+ * one has been presented and freed.
+ */
+static void render_supersede(compositor *compositor, render_commit *rc,
+			     render_commit *newer)
+{
+	rc->superseded_by = newer;
+	render_send_event(compositor, &rc->supersede);
+	render_retire(compositor, rc);
+}
+
+/*
+ * Latest wins: a commit that has not started uploading yet is replaced by
+ * a newer one and its buffer released right away. Its frame callbacks are
+ * carried over to the commit that replaced it. A commit without content
+ * does not replace anything, its callbacks join the pending commit.
+ */
+static void render_surface_queue(compositor_surface *csfc, render_commit *rc)
+{
+	compositor *compositor = csfc->compositor;
+	render_commit *old = csfc->pending;
+
+	if (old == NULL) {
+		csfc->pending = rc;
+		return;
+	}
+
+	if (!render_commit_has_content(rc) && render_commit_has_content(old)) {
+		render_supersede(compositor, rc, old);
+		return;
+	}
+
+	/* the skipped content still differs from what was uploaded before */
+	if (render_commit_has_content(old) && render_commit_has_content(rc))
+		damage_union(&rc->damage, &old->damage);
+	render_supersede(compositor, old, rc);
+	csfc->pending = rc;
+}
+
+/*
+ * A slot can be written when it is neither uploading nor displayed. A
+ * single slot is overwritten in place once its own upload completed; GL
+ * orders the new upload after the draws still sampling the old content.
+ */
+static tex_slot *render_surface_get_free_slot(compositor_surface *csfc)
+{
+	for (int i = 0; i < csfc->slot_num; i++) {
+		if (i != csfc->displayed_slot &&
+		    csfc->slots[i].status == TEX_FREE)
+			return &csfc->slots[i];
+	}
+	if (csfc->slot_num == 1 && csfc->slots[0].status == TEX_COMPLETE)
+		return &csfc->slots[0];
+	return NULL;
+}
+
+/* start the pending upload as soon as a slot is available */
+static void render_surface_flush(compositor_surface *csfc)
+{
+	compositor *compositor = csfc->compositor;
+	render_commit *rc = csfc->pending;
+	tex_slot *slot = NULL;
+
+	if (rc == NULL || rc->copying)
+		return;
+	if (render_commit_has_content(rc)) {
+		slot = render_surface_get_free_slot(csfc);
+		if (slot == NULL)
+			return;
+	}
+	csfc->pending = NULL;
+
+	if (slot && !render_commit_refine_damage(csfc, rc))
+		slot = NULL;
+	if (slot == NULL || upload_commit(slot, rc) == -1) {
+		/* nothing new to show: only signal the frame callbacks */
+		render_queue_frame_done(compositor, rc);
+		render_retire(compositor, rc);
+		return;
+	}
+
+	if (slot->status == TEX_COMPLETE)
+		slot->replaced = slot->commit;
+	slot->commit = rc;
+	slot->seq = ++csfc->upload_seq;
+	timeline_stamp(rc->timeline_id, TIMELINE_UPLOAD);
+	arm_upload_fence(slot);
+}
+
+/* called on the dispatch thread before the surface is published */
+void render_surface_init(compositor_surface *csfc)
+{
+	csfc->draw_index = -1;
+	csfc->pending = NULL;
+	csfc->slot_num = csfc->compositor->render.tex_slot_num;
+	csfc->displayed_slot = -1;
+	csfc->upload_seq = 0;
+	memset(&csfc->tiles, 0, sizeof(csfc->tiles));
+	for (int i = 0; i < TEX_SLOT_MAX; i++) {
+		tex_slot *slot = &csfc->slots[i];
+
+		slot->csfc = csfc;
+		for (int j = 0; j < TEX_PLANE_MAX; j++)
+			slot->texid[j] = 0;
+		slot->status = TEX_FREE;
+		slot->seq = 0;
+		slot->commit = NULL;
+		slot->replaced = NULL;
+		slot->tex_w = 0;
+		slot->tex_h = 0;
+		slot->tex_format = 0;
+		slot->tex_swizzle = NULL;
+		slot->tex_yuv = 0;
+		slot->tex_immutable = false;
+		damage_init(&slot->stale);
+		slot->glsyncobj_tex = NULL;
+		slot->fence_fd = -1;
+		slot->fence_source = NULL;
+		wl_list_init(&slot->upload_link);
+	}
+}
+
+static void render_surface_destroy(compositor_surface *csfc)
+{
+	compositor *compositor = csfc->compositor;
+
+	render_surface_unmap(csfc);
+
+	if (csfc->pending) {
+		render_retire(compositor, csfc->pending);
+		csfc->pending = NULL;
+	}
+	for (int i = 0; i < csfc->slot_num; i++) {
+		tex_slot *slot = &csfc->slots[i];
+
+		disarm_upload_fence(slot);
+		if (slot->replaced) {
+			render_retire(compositor, slot->replaced);
+			slot->replaced = NULL;
+		}
+		if (slot->commit) {
+			render_retire(compositor, slot->commit);
+			slot->commit = NULL;
+		}
+		for (int j = 0; j < TEX_PLANE_MAX; j++) {
+			if (slot->texid[j] != 0) {
+				glDeleteTextures(1, &slot->texid[j]);
+				slot->texid[j] = 0;
+			}
+		}
+		slot->tex_w = 0;
+		slot->tex_h = 0;
+		slot->tex_format = 0;
+		slot->tex_swizzle = NULL;
+		slot->tex_yuv = 0;
+		slot->tex_immutable = false;
+		slot->status = TEX_FREE;
+	}
+	csfc->displayed_slot = -1;
+	tile_grid_release(&csfc->tiles);
+	repaint_schedule(compositor);
+}
+
+/*
+ * A commit leaves the pending mailbox only through the flush, which waits
+ * for the copy, or through a retire, which is deferred until now. The
+ * surface is therefore alive unless the retire was deferred.
+ */
+static int render_handle_copies(int fd, uint32_t mask, void *data)
+{
+	compositor *compositor = data;
+	render_context *render = &compositor->render;
+	render_queue_node *node;
+
+	render_queue_clear_event(&render->copy_queue);
+	while ((node = render_queue_pop(&render->copy_queue)) != NULL) {
+		render_commit *rc = wl_container_of(node, rc, copy_node);
+
+		rc->copying = false;
+		if (rc->staging) {
+			rc->shm_data = rc->staging;
+			rc->shm_stride = rc->staging_stride;
+			rc->shm_format = rc->staging_format;
+		}
+		if (rc->retire_deferred)
+			render_retire(compositor, rc);
+		else if (rc->csfc->pending == rc)
+			render_surface_flush(rc->csfc);
+	}
+	return 0;
+}
+
+static int render_handle_commits(int fd, uint32_t mask, void *data)
+{
+	compositor *compositor = data;
+	render_context *render = &compositor->render;
+	render_queue_node *node;
+
+	render_queue_clear_event(&render->commit_queue);
+	while ((node = render_queue_pop(&render->commit_queue)) != NULL) {
+		render_commit *rc = wl_container_of(node, rc, node);
+		compositor_surface *csfc = rc->csfc;
+
+		switch (rc->type) {
+		case RENDER_COMMIT_BUFFER:
+			render_surface_queue(csfc, rc);
+			render_surface_flush(csfc);
+			break;
+		case RENDER_COMMIT_MAP:
+			render_surface_map(csfc);
+			repaint_schedule(compositor);
+			render_send_event(compositor, &rc->retire);
+			break;
+		case RENDER_COMMIT_DESTROY:
+			render_surface_destroy(csfc);
+			render_send_event(compositor, &rc->retire);
+			break;
+		case RENDER_COMMIT_FORGET:
+			egl_forget_dmabuf(rc->scanout.id);
+			render_send_event(compositor, &rc->retire);
+			break;
+		case RENDER_COMMIT_QUIT:
+			render->running = false;
+			free(rc);
+			break;
+		}
+	}
+	return 0;
+}
+
+/*--------------------------------------------------------------------------- *
+ *  render thread
+ *--------------------------------------------------------------------------- */
+/* the commit is shown by the frame being repainted */
+static void render_frame_add(render_context *render, render_commit *rc)
+{
+	timeline_frame_add(rc->timeline_id);
+	if (rc->present_nsec == 0 && wl_list_empty(&rc->present_link))
+		wl_list_insert(render->present_list.prev, &rc->present_link);
+}
+
+/*
+ * Hand the topmost dmabuf surfaces over to overlay planes, the lowest
+ * visible surface always stays on the primary plane. Returns the number
+ * of draws left to the primary plane: those below the first overlay.
+ */
+static int render_assign_overlays(compositor *compositor)
+{
+	render_context *render = &compositor->render;
+	winsys_layer layers[WINSYS_OVERLAY_MAX];
+	int index[WINSYS_OVERLAY_MAX];
+	int num = 0;
+	int lowest = -1;
+
+	if (render->overlay_num == 0)
+		return render->draw_num;
+
+	for (int i = 0; i < render->draw_num; i++) {
+		if (render->draws[i].texid[0] != 0) {
+			lowest = i;
+			break;
+		}
+	}
+	/* candidates top down, stored bottom to top */
+	for (int i = render->draw_num - 1;
+	     i > lowest && num < render->overlay_num; i--) {
+		render_commit *rc = render->draws[i].commit;
+
+		if (render->draws[i].texid[0] == 0)
+			continue;
+		if (rc->scanout.plane_num == 0)
+			break;
+		num++;
+		index[render->overlay_num - num] = i;
+		layers[render->overlay_num - num] =
+			(winsys_layer){ .buf = rc->scanout, .x = 0, .y = 0 };
+	}
+
+	int first = render->overlay_num - num;
+	int placed = egl_set_overlays(&layers[first], num);
+	if (placed == 0)
+		return render->draw_num;
+
+	first += num - placed;
+	for (int i = first; i < render->overlay_num; i++) {
+		render_commit *rc = render->draws[index[i]].commit;
+
+		render_frame_add(render, rc);
+		render_scanout_hold(render, rc);
+	}
+	return index[first];
+}
+
+/*
+ * A lone fullscreen dmabuf left to the primary plane is flipped to as is,
+ * without drawing the frame. The window system refuses buffers it cannot
+ * show unscaled, those are composited: -1 is returned. Returns
+ * WINSYS_OVERLAYS_REFUSED if the flip failed because of the overlays,
+ * WINSYS_FLIP_DROPPED if the display was busy.
+ */
+static int render_scanout(compositor *compositor, int draw_num)
+{
+	render_context *render = &compositor->render;
+	render_commit *rc = NULL;
+
+	if (!render->scanout)
+		return -1;
+	for (int i = 0; i < draw_num; i++) {
+		if (render->draws[i].texid[0] == 0)
+			continue;
+		if (rc)
+			return -1;
+		rc = render->draws[i].commit;
+	}
+	if (rc == NULL || rc->scanout.plane_num == 0 || !rc->scanout_fullscreen)
+		return -1;
+	int ret = egl_scanout(&rc->scanout, render->vsync);
+	if (ret < 0)
+		return ret;
+
+	render_frame_add(render, rc);
+	render_scanout_hold(render, rc);
+	return 0;
+}
+
+/* draw the first draw_num surfaces into the primary plane and flip */
+static int render_composite(compositor *compositor, int draw_num,
+			    uint64_t start_nsec)
+{
+	render_context *render = &compositor->render;
+	int ret;
+
+	glClear(GL_COLOR_BUFFER_BIT);
+	for (int i = 0; i < draw_num; i++) {
+		render_draw *draw = &render->draws[i];
+		render_commit *rc = draw->commit;
+
+		if (draw->texid[0] == 0)
+			continue;
+		render_frame_add(render, rc);
+		if (draw->yuv)
+			ret = draw_2d_texture_yuv(draw->texid, 0, 0,
+						  draw->width, draw->height, 0,
+						  draw->yuv);
+		else
+			ret = draw_2d_texture_swizzle(draw->texid[0], 0, 0,
+						      draw->width, draw->height,
+						      0, draw->swizzle);
+		if (ret == -1)
+			return ret;
+	}
+	timeline_frame_stamp(TIMELINE_DRAW);
+	ret = egl_swap_buffers();
+	if (ret == -1)
+		return ret;
+	timeline_frame_stamp(TIMELINE_SWAP);
+	repaint_finished(compositor, get_monotonic_nsec() - start_nsec);
+	return egl_present(render->vsync);
+}
+
+static int render_repaint(compositor *compositor)
+{
+	render_context *render = &compositor->render;
+	int ret;
+	uint64_t start_nsec = get_monotonic_nsec();
+
+	/* callbacks queued from now on wait for the following frame */
+	wl_list_insert_list(render->done_flip_list.prev, &render->done_list);
+	wl_list_init(&render->done_list);
+
+	timeline_frame_begin();
+	int draw_num = render_assign_overlays(compositor);
+	ret = render_scanout(compositor, draw_num);
+	if (ret == 0) {
+		timeline_frame_stamp(TIMELINE_DRAW);
+		repaint_finished(compositor, get_monotonic_nsec() - start_nsec);
+		return 0;
+	}
+	if (ret == -1)
+		ret = render_composite(compositor, draw_num, start_nsec);
+	/* the overlays passed the test but not the flip: draw them too */
+	if (ret == WINSYS_OVERLAYS_REFUSED) {
+		render_scanout_drop_pending(compositor);
+		ret = render_composite(compositor, render->draw_num,
+				       start_nsec);
+	}
+	if (ret == WINSYS_FLIP_DROPPED) {
+		render_frame_drop(compositor);
+		return 0;
+	}
+	if (ret < 0)
+		return -1;
+
+	/* no flip event will follow: the swap is all we know about */
+	if (!egl_flip_pending()) {
+		render_scanout_flipped(compositor);
+		render_frame_presented(compositor, get_monotonic_nsec(), 0, 0);
+	}
+	return 0;
+}
+
+/* page flip completion, see winsys_swap() */
+static int render_handle_display_events(int fd, uint32_t mask, void *data)
+{
+	compositor *compositor = data;
+
+	if (egl_dispatch_events() == -1)
+		compositor->render.running = false;
+	return 0;
+}
+
+static void *render_thread_main(void *data)
+{
+	compositor *compositor = data;
+	render_context *render = &compositor->render;
+
+	if (egl_make_current() == 0) {
+		while (render->running) {
+			wl_event_loop_dispatch(render->loop, -1);
+			/* a repaint waits for the pending flip to complete */
+			if (render->need_repaint && !egl_flip_pending()) {
+				render->need_repaint = false;
+				if (render_repaint(compositor) == -1)
+					break;
+			}
+		}
+		egl_release_current();
+	}
+
+	render_queue_push(&render->event_queue, &render->exit_event.node);
+	return NULL;
+}
+
+int render_init(compositor *compositor, bool vsync, int repaint_window_msec,
+		int tex_slot_num, bool pbo_upload)
+{
+	render_context *render = &compositor->render;
+
+	render->running = true;
+	render->tex_slot_num = tex_slot_num;
+	render->vsync = vsync;
+	render->need_repaint = false;
+	render->exit_event.type = RENDER_EVENT_EXIT;
+	render->exit_event.commit = NULL;
+	render->draws = NULL;
+	render->draw_num = 0;
+	render->draw_cap = 0;
+	wl_list_init(&render->upload_list);
+	wl_list_init(&render->done_list);
+	wl_list_init(&render->done_flip_list);
+	wl_list_init(&render->present_list);
+
+	/* whatever is set up here is released by render_stop() */
+	render->commit_queue.event_fd = -1;
+	render->event_queue.event_fd = -1;
+	render->copy_queue.event_fd = -1;
+	render->loop = wl_event_loop_create();
+	if (render->loop == NULL) {
+		ELOG("%s\n", __FUNCTION__);
+		return -1;
+	}
+	if (render_queue_init(&render->commit_queue) == -1 ||
+	    render_queue_init(&render->event_queue) == -1 ||
+	    render_queue_init(&render->copy_queue) == -1)
+		return -1;
+	render->commit_source = wl_event_loop_add_fd(
+		render->loop, render->commit_queue.event_fd, WL_EVENT_READABLE,
+		render_handle_commits, compositor);
+	render->copy_source = wl_event_loop_add_fd(
+		render->loop, render->copy_queue.event_fd, WL_EVENT_READABLE,
+		render_handle_copies, compositor);
+	render->fence_timer = wl_event_loop_add_timer(
+		render->loop, poll_upload_fences, compositor);
+	if (render->commit_source == NULL || render->copy_source == NULL ||
+	    render->fence_timer == NULL) {
+		ELOG("%s\n", __FUNCTION__);
+		return -1;
+	}
+
+	int display_fd = egl_get_event_fd();
+	if (display_fd >= 0) {
+		render->display_source = wl_event_loop_add_fd(
+			render->loop, display_fd, WL_EVENT_READABLE,
+			render_handle_display_events, compositor);
+		if (render->display_source == NULL) {
+			ELOG("%s\n", __FUNCTION__);
+			return -1;
+		}
+	}
+
+	EGL_GET_PROC_ADDR(glEGLImageTargetTexture2DOES);
+	EGL_GET_PROC_ADDR(eglDestroyImageKHR);
+	EGL_GET_PROC_ADDR(eglCreateSyncKHR);
+	EGL_GET_PROC_ADDR(eglDestroySyncKHR);
+	EGL_GET_PROC_ADDR(eglDupNativeFenceFDANDROID);
+
+	const char *extensions =
+		eglQueryString(compositor->egl_display, EGL_EXTENSIONS);
+	if (extensions != NULL &&
+	    strstr(extensions, "EGL_ANDROID_native_fence_sync") != NULL &&
+	    eglCreateSyncKHR && eglDestroySyncKHR &&
+	    eglDupNativeFenceFDANDROID) {
+		s_native_fence = true;
+	} else {
+		ILOG("EGL_ANDROID_native_fence_sync is not supported, poll upload fences\n");
+	}
+	/* acquire fences of explicit sync */
+	if (extensions != NULL &&
+	    strstr(extensions, "EGL_KHR_wait_sync") != NULL)
+		EGL_GET_PROC_ADDR(eglWaitSyncKHR);
+
+	/* called while the context is still current on the main thread */
+	const char *gl_version = (const char *)glGetString(GL_VERSION);
+	const char *gl_extensions = (const char *)glGetString(GL_EXTENSIONS);
+	int gl_major = 0;
+	if (gl_version)
+		sscanf(gl_version, "OpenGL ES %d", &gl_major);
+	if (gl_major >= 3 || (gl_extensions != NULL &&
+			      strstr(gl_extensions, "GL_EXT_unpack_subimage"))) {
+		s_unpack_subimage = true;
+	} else {
+		ILOG("GL_EXT_unpack_subimage is not supported, upload padded rows one by one\n");
+	}
+	if (gl_major >= 3 ||
+	    (gl_extensions != NULL &&
+	     strstr(gl_extensions, "GL_EXT_texture_type_2_10_10_10_REV"))) {
+		s_tex_rgb10_a2 = true;
+	} else {
+		ILOG("GL_EXT_texture_type_2_10_10_10_REV is not supported, convert 10-bit shm buffers\n");
+	}
+	if (gl_major >= 3) {
+		s_tex_storage = true;
+		s_tex_storage_bgra =
+			gl_extensions != NULL &&
+			strstr(gl_extensions, "GL_EXT_texture_storage") != NULL;
+	}
+
+	const char *yuv_color = getenv_str("WLPROXY_YUV_COLOR", "auto");
+	if (strcmp(yuv_color, "bt601") == 0)
+		s_yuv_color = YUV_COLOR_BT601;
+	else if (strcmp(yuv_color, "bt709") == 0)
+		s_yuv_color = YUV_COLOR_BT709;
+	else if (strcmp(yuv_color, "auto") != 0)
+		ELOG("%s invalid yuv color space %s\n", __FUNCTION__,
+		     yuv_color);
+	s_yuv_full_range =
+		strcmp(getenv_str("WLPROXY_YUV_RANGE", "limited"), "full") == 0;
+
+	/* shm rows of 2 and 3 byte pixels need not be 4-byte aligned */
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+	/* pixel buffer objects are core in GLES3 */
+	render->pbo_upload = pbo_upload && gl_major >= 3;
+	for (int i = 0; i < PBO_RING_SIZE; i++) {
+		render->pbo[i] = 0;
+		render->pbo_size[i] = 0;
+	}
+	render->pbo_next = 0;
+	if (pbo_upload && !render->pbo_upload)
+		ILOG("pixel buffer objects need GLES3, upload shm buffers directly\n");
+	ILOG("shm upload: %s\n", render->pbo_upload ? "pbo" : "direct");
+
+	render->tile_hash = getenv_int("WLPROXY_TILE_HASH", 0) != 0;
+	if (render->tile_hash)
+		tile_hash_init();
+	ILOG("shm tile hash: %s\n", render->tile_hash ? "on" : "off");
+
+	render->scanout = getenv_int("WLPROXY_SCANOUT", 1) != 0;
+	render->overlay_num = render->scanout ? egl_get_overlay_num() : 0;
+	render->scanout_front_num = 0;
+	render->scanout_pending_num = 0;
+	ILOG("scanout: %s, overlay planes: %d\n",
+	     render->scanout ? "on" : "off", render->overlay_num);
+
+	return repaint_scheduler_init(compositor, render->loop,
+				      repaint_window_msec);
+}
+
+/* hands the EGL context over from the calling thread to the render thread */
+int render_start(compositor *compositor)
+{
+	render_context *render = &compositor->render;
+
+	if (egl_release_current() == -1)
+		return -1;
+
+	int ret = pthread_create(&render->thread, NULL, render_thread_main,
+				 compositor);
+	if (ret != 0) {
+		ELOG("%s pthread_create: %s\n", __FUNCTION__, strerror(ret));
+		egl_make_current();
+		return -1;
+	}
+	s_thread_started = true;
+	return 0;
+}
+
+static void render_remove_source(struct wl_event_source **source)
+{
+	if (*source) {
+		wl_event_source_remove(*source);
+		*source = NULL;
+	}
+}
+
+/* the event loop does not free the sources left on it */
+static void render_release(render_context *render)
+{
+	if (render->loop == NULL)
+		return;
+	render_remove_source(&render->commit_source);
+	render_remove_source(&render->copy_source);
+	render_remove_source(&render->display_source);
+	render_remove_source(&render->fence_timer);
+	render_remove_source(&render->repaint.timer);
+	wl_event_loop_destroy(render->loop);
+	render->loop = NULL;
+	render_queue_release(&render->commit_queue);
+	render_queue_release(&render->event_queue);
+	render_queue_release(&render->copy_queue);
+}
+
+void render_stop(compositor *compositor)
+{
+	if (s_thread_started) {
+		render_commit *rc =
+			render_commit_create(RENDER_COMMIT_QUIT, NULL);
+		if (rc == NULL)
+			return;
+		render_submit(compositor, rc);
+		pthread_join(compositor->render.thread, NULL);
+		s_thread_started = false;
+	}
+	free(compositor->render.draws);
+	compositor->render.draws = NULL;
+	free(compositor->render.convert_buf);
+	compositor->render.convert_buf = NULL;
+	render_release(&compositor->render);
+}
@@ -0,0 +1,109 @@
+// SPDX-License-Identifier: Apache-2.0
+/**
+ * Copyright (c) 2024  Panasonic Automotive Systems, Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "util_log.h"
+#include "render_queue.h"
+
+int render_queue_init(render_queue *queue)
+{
+	atomic_store_explicit(&queue->stub.next, NULL, memory_order_relaxed);
+	atomic_store_explicit(&queue->head, &queue->stub, memory_order_relaxed);
+	queue->tail = &queue->stub;
+
+	queue->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (queue->event_fd < 0) {
+		ELOG("%s eventfd: %m\n", __FUNCTION__);
+		return -1;
+	}
+	return 0;
+}
+
+void render_queue_release(render_queue *queue)
+{
+	if (queue->event_fd >= 0) {
+		close(queue->event_fd);
+		queue->event_fd = -1;
+	}
+}
+
+static void render_queue_link(render_queue *queue, render_queue_node *node)
+{
+	atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+	render_queue_node *prev = atomic_exchange_explicit(
+		&queue->head, node, memory_order_acq_rel);
+	atomic_store_explicit(&prev->next, node, memory_order_release);
+}
+
+void render_queue_push(render_queue *queue, render_queue_node *node)
+{
+	uint64_t one = 1;
+
+	render_queue_link(queue, node);
+	if (write(queue->event_fd, &one, sizeof(one)) < 0) {
+		/* EAGAIN: the counter is saturated, the consumer is awake */
+	}
+}
+
+/*
+ * Called by the consumer only. Returns NULL when the queue is empty or
+ * when a producer is half way through a push; that producer signals the
+ * eventfd once its node is linked, so nothing is lost.
+ */
+render_queue_node *render_queue_pop(render_queue *queue)
+{
+	render_queue_node *tail = queue->tail;
+	render_queue_node *next =
+		atomic_load_explicit(&tail->next, memory_order_acquire);
+
+	if (tail == &queue->stub) {
+		if (next == NULL)
+			return NULL;
+		queue->tail = next;
+		tail = next;
+		next = atomic_load_explicit(&tail->next, memory_order_acquire);
+	}
+
+	if (next) {
+		queue->tail = next;
+		return tail;
+	}
+
+	if (tail != atomic_load_explicit(&queue->head, memory_order_acquire))
+		return NULL;
+
+	render_queue_link(queue, &queue->stub);
+	next = atomic_load_explicit(&tail->next, memory_order_acquire);
+	if (next) {
+		queue->tail = next;
+		return tail;
+	}
+	return NULL;
+}
+
+/* must be called before draining so that no wakeup is lost */
+void render_queue_clear_event(render_queue *queue)
+{
+	uint64_t count;
+
+	if (read(queue->event_fd, &count, sizeof(count)) < 0) {
+		/* EAGAIN: nothing was signaled */
+	}
+}
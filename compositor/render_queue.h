@@ -0,0 +1,45 @@
+// SPDX-License-Identifier: Apache-2.0
+/**
+ * Copyright (c) 2024  Panasonic Automotive Systems, Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef RENDER_QUEUE_H_
+#define RENDER_QUEUE_H_
+
+#include <stdatomic.h>
+
+/*
+ * Intrusive lock-free multi-producer/single-consumer queue. Producers
+ * never block; the consumer is woken up through an eventfd which can be
+ * added to a wl_event_loop.
+ */
+typedef struct render_queue_node {
+	struct render_queue_node *_Atomic next;
+} render_queue_node;
+
+typedef struct render_queue {
+	render_queue_node *_Atomic head; /* producers */
+	render_queue_node *tail; /* consumer */
+	render_queue_node stub;
+	int event_fd;
+} render_queue;
+
+int render_queue_init(render_queue *queue);
+void render_queue_release(render_queue *queue);
+void render_queue_push(render_queue *queue, render_queue_node *node);
+render_queue_node *render_queue_pop(render_queue *queue);
+void render_queue_clear_event(render_queue *queue);
+
+#endif /* RENDER_QUEUE_H_ */
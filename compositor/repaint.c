@@ -0,0 +1,187 @@
+// SPDX-License-Identifier: Apache-2.0
+/**
+ * Copyright (c) 2024  Panasonic Automotive Systems, Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <wayland-server.h>
+#include <presentation-time-server-protocol.h>
+#include "util_egl.h"
+#include "util_log.h"
+#include "compositor.h"
+
+#define NSEC_PER_MSEC 1000000ULL
+#define NSEC_PER_SEC 1000000000ULL
+
+/* margin kept on top of the measured composition time */
+#define REPAINT_WINDOW_MARGIN_NSEC (1 * NSEC_PER_MSEC)
+#define REPAINT_WINDOW_MIN_NSEC (1 * NSEC_PER_MSEC)
+
+static compositor *s_compositor = NULL;
+
+uint64_t get_monotonic_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void repaint_update_refresh(repaint_scheduler *rs)
+{
+	unsigned int mhz = egl_get_refresh_mhz();
+	if (mhz == 0)
+		return;
+
+	rs->refresh_nsec = NSEC_PER_SEC * 1000 / mhz;
+	if (rs->max_window_nsec == 0 ||
+	    rs->max_window_nsec > rs->refresh_nsec - REPAINT_WINDOW_MIN_NSEC) {
+		rs->max_window_nsec = rs->refresh_nsec - REPAINT_WINDOW_MIN_NSEC;
+	}
+	if (rs->window_nsec > rs->max_window_nsec)
+		rs->window_nsec = rs->max_window_nsec;
+}
+
+/* kernel page flip timestamps are taken from CLOCK_MONOTONIC */
+static void repaint_page_flip(unsigned int frame, unsigned int sec,
+			      unsigned int usec, bool vsync)
+{
+	compositor *compositor = s_compositor;
+	if (compositor == NULL)
+		return;
+	repaint_scheduler *rs = &compositor->render.repaint;
+
+	timeline_frame_stamp(TIMELINE_FLIP);
+	rs->last_vblank_nsec = (uint64_t)sec * NSEC_PER_SEC +
+			       (uint64_t)usec * 1000;
+	if (rs->refresh_nsec == 0)
+		repaint_update_refresh(rs);
+
+	/*
+	 * Timestamp and completion both come from the flip event, which
+	 * also tells whether the flip waited for vblank: overlays force it.
+	 */
+	uint32_t flags = WP_PRESENTATION_FEEDBACK_KIND_HW_CLOCK |
+			 WP_PRESENTATION_FEEDBACK_KIND_HW_COMPLETION;
+	if (vsync)
+		flags |= WP_PRESENTATION_FEEDBACK_KIND_VSYNC;
+	render_scanout_flipped(compositor);
+	render_frame_presented(compositor, rs->last_vblank_nsec, frame, flags);
+}
+
+static int repaint_timer_expired(void *data)
+{
+	compositor *compositor = data;
+
+	compositor->render.repaint.timer_armed = false;
+	compositor->render.need_repaint = true;
+	return 0;
+}
+
+int repaint_scheduler_init(compositor *compositor, struct wl_event_loop *loop,
+			   int window_msec)
+{
+	repaint_scheduler *rs = &compositor->render.repaint;
+
+	rs->timer = wl_event_loop_add_timer(loop, repaint_timer_expired,
+					    compositor);
+	if (rs->timer == NULL) {
+		ELOG("%s\n", __FUNCTION__);
+		return -1;
+	}
+	rs->timer_armed = false;
+	rs->window_nsec = (uint64_t)window_msec * NSEC_PER_MSEC;
+	rs->peak_composite_nsec = 0;
+	rs->last_vblank_nsec = 0;
+	rs->refresh_nsec = 0;
+	rs->max_window_nsec = 0;
+	repaint_update_refresh(rs);
+
+	s_compositor = compositor;
+	egl_set_page_flip_func(repaint_page_flip);
+
+	ILOG("repaint window: %d msec, refresh: %u mHz\n", window_msec,
+	     egl_get_refresh_mhz());
+	return 0;
+}
+
+/*
+ * Request a repaint for the upcoming vblank. Composition is started
+ * window_nsec before the predicted vblank so that commits arriving
+ * meanwhile still make it into the frame. Without any page flip
+ * timestamp (before the first flip, or a window system without flip
+ * events) repaint right away.
+ */
+void repaint_schedule(compositor *compositor)
+{
+	repaint_scheduler *rs = &compositor->render.repaint;
+
+	if (compositor->render.need_repaint || rs->timer_armed)
+		return;
+
+	if (rs->last_vblank_nsec == 0 || rs->refresh_nsec == 0) {
+		compositor->render.need_repaint = true;
+		return;
+	}
+
+	uint64_t now = get_monotonic_nsec();
+	uint64_t next_vblank = rs->last_vblank_nsec + rs->refresh_nsec;
+	if (next_vblank <= now) {
+		uint64_t missed = (now - rs->last_vblank_nsec) /
+				  rs->refresh_nsec;
+		next_vblank = rs->last_vblank_nsec +
+			      (missed + 1) * rs->refresh_nsec;
+	}
+
+	uint64_t repaint_at = next_vblank - rs->window_nsec;
+	if (repaint_at <= now) {
+		compositor->render.need_repaint = true;
+		return;
+	}
+
+	/* timers have msec resolution: rather start early than late */
+	int delay_msec = (repaint_at - now) / NSEC_PER_MSEC;
+	if (delay_msec == 0) {
+		compositor->render.need_repaint = true;
+		return;
+	}
+	wl_event_source_timer_update(rs->timer, delay_msec);
+	rs->timer_armed = true;
+}
+
+/*
+ * Feed the measured composition time (start of repaint up to the buffer
+ * being handed to the display) back into the window. A decaying peak
+ * follows slow frames immediately and relaxes over ~16 frames.
+ */
+void repaint_finished(compositor *compositor, uint64_t composite_nsec)
+{
+	repaint_scheduler *rs = &compositor->render.repaint;
+
+	rs->peak_composite_nsec -= rs->peak_composite_nsec >> 4;
+	if (composite_nsec > rs->peak_composite_nsec)
+		rs->peak_composite_nsec = composite_nsec;
+
+	uint64_t window = rs->peak_composite_nsec +
+			  (rs->peak_composite_nsec >> 2) +
+			  REPAINT_WINDOW_MARGIN_NSEC;
+	if (window < REPAINT_WINDOW_MIN_NSEC)
+		window = REPAINT_WINDOW_MIN_NSEC;
+	if (rs->max_window_nsec && window > rs->max_window_nsec)
+		window = rs->max_window_nsec;
+	rs->window_nsec = window;
+}
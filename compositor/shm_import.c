@@ -0,0 +1,462 @@
+// SPDX-License-Identifier: Apache-2.0
+/**
+ * Copyright (c) 2024  Panasonic Automotive Systems, Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Zero-copy import of shm buffers. A memfd backed wl_shm_pool is wrapped
+ * into a dma-buf by /dev/udmabuf and its buffers are imported as EGLImages
+ * with EGL_EXT_image_dma_buf_import, so the GPU samples client memory
+ * directly instead of receiving an upload.
+ *
+ * libwayland keeps the pool fd to itself, so the requests creating pools
+ * and buffers are observed through a protocol logger: create_pool carries
+ * the fd, which is duplicated before libwayland maps and closes it.
+ *
+ * The logger also runs with the import disabled: libwayland only checks
+ * the first plane of a buffer against its pool, the pool sizes recorded
+ * here let the chroma planes of YUV buffers be checked as well.
+ * Everything here runs on the dispatch thread.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/udmabuf.h>
+#include <wayland-server.h>
+#include "util_egl.h"
+#include "util_log.h"
+#include "compositor.h"
+
+#define FOURCC(a, b, c, d)                                                     \
+	((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) |        \
+	 ((uint32_t)(d) << 24))
+
+/*
+ * The two legacy wl_shm codes differ from their DRM fourcc, all others
+ * are equal. Only single plane formats that GPUs commonly sample are
+ * imported, anything else goes through the upload path.
+ */
+static const struct {
+	uint32_t shm_format;
+	uint32_t fourcc;
+	int32_t bpp;
+} s_import_formats[] = {
+	{ WL_SHM_FORMAT_ARGB8888, FOURCC('A', 'R', '2', '4'), 4 },
+	{ WL_SHM_FORMAT_XRGB8888, FOURCC('X', 'R', '2', '4'), 4 },
+	{ WL_SHM_FORMAT_ABGR8888, WL_SHM_FORMAT_ABGR8888, 4 },
+	{ WL_SHM_FORMAT_XBGR8888, WL_SHM_FORMAT_XBGR8888, 4 },
+	{ WL_SHM_FORMAT_RGB565, WL_SHM_FORMAT_RGB565, 2 },
+};
+
+/* a wl_shm_pool as seen by the logger */
+typedef struct shm_import_pool {
+	struct wl_list link; /* s_pool_list while not bound to its resource */
+	struct wl_client *client;
+	uint32_t id;
+	struct wl_listener destroy_listener; /* of the pool resource */
+	int ref_count; /* pool resource plus buffers created from it */
+	int memfd; /* -1 when the pool cannot be imported */
+	int32_t size;
+	int dmabuf_fd; /* udmabuf of the whole pool, -1 until created */
+	int32_t dmabuf_size;
+	bool dmabuf_failed;
+} shm_import_pool;
+
+/* a wl_shm_pool.create_buffer not attached yet */
+typedef struct shm_import_pending {
+	struct wl_list link;
+	struct wl_client *client;
+	uint32_t id;
+	shm_import_pool *pool;
+	int32_t offset;
+} shm_import_pending;
+
+typedef struct shm_import_client {
+	struct wl_listener destroy_listener;
+} shm_import_client;
+
+static PFNEGLCREATEIMAGEKHRPROC eglCreateImageKHR;
+
+static bool s_enabled = false;
+static int s_udmabuf_fd = -1;
+static long s_page_size = 4096;
+static struct wl_protocol_logger *s_logger = NULL;
+
+/* newest first, object ids are reused by the clients */
+static struct wl_list s_pool_list;
+static struct wl_list s_pending_list;
+
+static void shm_import_pool_unref(shm_import_pool *pool)
+{
+	if (--pool->ref_count > 0)
+		return;
+	if (pool->dmabuf_fd >= 0)
+		close(pool->dmabuf_fd);
+	if (pool->memfd >= 0)
+		close(pool->memfd);
+	free(pool);
+}
+
+/* a grown pool gets a new udmabuf, existing EGLImages keep the old one */
+static void shm_import_pool_drop_dmabuf(shm_import_pool *pool)
+{
+	if (pool->dmabuf_fd >= 0) {
+		close(pool->dmabuf_fd);
+		pool->dmabuf_fd = -1;
+	}
+}
+
+static void shm_import_pending_free(shm_import_pending *pending)
+{
+	wl_list_remove(&pending->link);
+	shm_import_pool_unref(pending->pool);
+	free(pending);
+}
+
+static void shm_import_client_destroy(struct wl_listener *listener,
+				      void *data)
+{
+	shm_import_client *sic =
+		wl_container_of(listener, sic, destroy_listener);
+	struct wl_client *client = data;
+	shm_import_pending *pending, *ptmp;
+	shm_import_pool *pool, *tmp;
+
+	wl_list_for_each_safe(pending, ptmp, &s_pending_list, link) {
+		if (pending->client == client)
+			shm_import_pending_free(pending);
+	}
+	wl_list_for_each_safe(pool, tmp, &s_pool_list, link) {
+		if (pool->client == client) {
+			wl_list_remove(&pool->link);
+			shm_import_pool_unref(pool);
+		}
+	}
+	free(sic);
+}
+
+static void shm_import_track_client(struct wl_client *client)
+{
+	if (wl_client_get_destroy_listener(client, shm_import_client_destroy))
+		return;
+
+	shm_import_client *sic = calloc(sizeof(*sic), 1);
+	if (sic == NULL)
+		return;
+	sic->destroy_listener.notify = shm_import_client_destroy;
+	wl_client_add_destroy_listener(client, &sic->destroy_listener);
+}
+
+static void shm_import_create_pool(struct wl_client *client, uint32_t id,
+				   int fd, int32_t size)
+{
+	shm_import_pool *pool, *tmp;
+
+	/* an older pool with the same id was never used */
+	wl_list_for_each_safe(pool, tmp, &s_pool_list, link) {
+		if (pool->client == client && pool->id == id) {
+			wl_list_remove(&pool->link);
+			shm_import_pool_unref(pool);
+		}
+	}
+
+	pool = calloc(sizeof(*pool), 1);
+	if (pool == NULL)
+		return;
+	pool->memfd = -1;
+
+	/* udmabuf only accepts memfds which cannot shrink */
+	int seals = s_enabled ? fcntl(fd, F_GET_SEALS) : -1;
+	if (seals >= 0 && (seals & F_SEAL_SHRINK) && !(seals & F_SEAL_WRITE)) {
+		pool->memfd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+		if (pool->memfd < 0)
+			ELOG("%s dup: %m\n", __FUNCTION__);
+	}
+	pool->client = client;
+	pool->id = id;
+	pool->ref_count = 1;
+	pool->size = size;
+	pool->dmabuf_fd = -1;
+	wl_list_insert(&s_pool_list, &pool->link);
+	shm_import_track_client(client);
+}
+
+static void shm_import_pool_destroy(struct wl_listener *listener, void *data)
+{
+	shm_import_pool *pool =
+		wl_container_of(listener, pool, destroy_listener);
+
+	shm_import_pool_unref(pool);
+}
+
+/* the pool resource exists from its first request on */
+static shm_import_pool *shm_import_pool_get(struct wl_resource *resource)
+{
+	struct wl_listener *listener = wl_resource_get_destroy_listener(
+		resource, shm_import_pool_destroy);
+	struct wl_client *client = wl_resource_get_client(resource);
+	uint32_t id = wl_resource_get_id(resource);
+	shm_import_pool *pool;
+
+	if (listener)
+		return wl_container_of(listener, pool, destroy_listener);
+
+	wl_list_for_each(pool, &s_pool_list, link) {
+		if (pool->client == client && pool->id == id) {
+			wl_list_remove(&pool->link);
+			pool->destroy_listener.notify = shm_import_pool_destroy;
+			wl_resource_add_destroy_listener(
+				resource, &pool->destroy_listener);
+			return pool;
+		}
+	}
+	return NULL;
+}
+
+static void shm_import_create_buffer(shm_import_pool *pool, uint32_t id,
+				     int32_t offset)
+{
+	shm_import_pending *pending, *tmp;
+
+	wl_list_for_each_safe(pending, tmp, &s_pending_list, link) {
+		if (pending->client == pool->client && pending->id == id)
+			shm_import_pending_free(pending);
+	}
+
+	pending = calloc(sizeof(*pending), 1);
+	if (pending == NULL)
+		return;
+	pending->client = pool->client;
+	pending->id = id;
+	pending->pool = pool;
+	pending->offset = offset;
+	pool->ref_count++;
+	wl_list_insert(&s_pending_list, &pending->link);
+}
+
+static void shm_import_log(void *user_data,
+			   enum wl_protocol_logger_type direction,
+			   const struct wl_protocol_logger_message *msg)
+{
+	if (direction != WL_PROTOCOL_LOGGER_REQUEST)
+		return;
+
+	const char *class = wl_resource_get_class(msg->resource);
+	const char *name = msg->message->name;
+	const union wl_argument *args = msg->arguments;
+
+	if (strcmp(class, "wl_shm") == 0) {
+		if (strcmp(name, "create_pool") == 0)
+			shm_import_create_pool(
+				wl_resource_get_client(msg->resource),
+				args[0].n, args[1].h, args[2].i);
+		return;
+	}
+	if (strcmp(class, "wl_shm_pool") != 0)
+		return;
+
+	shm_import_pool *pool = shm_import_pool_get(msg->resource);
+	if (pool == NULL)
+		return;
+	if (strcmp(name, "create_buffer") == 0) {
+		shm_import_create_buffer(pool, args[0].n, args[1].i);
+	} else if (strcmp(name, "resize") == 0) {
+		pool->size = args[0].i;
+		pool->dmabuf_failed = false;
+		shm_import_pool_drop_dmabuf(pool);
+	}
+}
+
+static bool shm_import_pool_dmabuf(shm_import_pool *pool)
+{
+	if (pool->dmabuf_fd >= 0)
+		return true;
+	if (pool->memfd < 0 || pool->dmabuf_failed)
+		return false;
+
+	struct udmabuf_create create = {
+		.memfd = pool->memfd,
+		.flags = UDMABUF_FLAGS_CLOEXEC,
+		.offset = 0,
+		.size = pool->size & ~(s_page_size - 1),
+	};
+	if (create.size > 0)
+		pool->dmabuf_fd = ioctl(s_udmabuf_fd, UDMABUF_CREATE, &create);
+	if (pool->dmabuf_fd < 0) {
+		DLOG("%s UDMABUF_CREATE: %m\n", __FUNCTION__);
+		pool->dmabuf_failed = true;
+		return false;
+	}
+	pool->dmabuf_size = create.size;
+	return true;
+}
+
+/*
+ * Called on the first attach of a buffer: take over what the logger
+ * recorded for its create_buffer request.
+ */
+static void shm_import_buffer_lookup(compositor_buffer *buffer)
+{
+	struct wl_client *client = wl_resource_get_client(buffer->resource);
+	uint32_t id = wl_resource_get_id(buffer->resource);
+	shm_import_pending *pending;
+
+	buffer->import_checked = true;
+	wl_list_for_each(pending, &s_pending_list, link) {
+		if (pending->client == client && pending->id == id) {
+			buffer->import_pool = pending->pool;
+			buffer->import_offset = pending->offset;
+			wl_list_remove(&pending->link);
+			free(pending);
+			return;
+		}
+	}
+}
+
+/*
+ * Create an EGLImage sampling the shm buffer in place, or return
+ * EGL_NO_IMAGE_KHR to have the buffer uploaded. The image is kept with
+ * the buffer like those of GPU buffers, a failed buffer is not retried
+ * on later commits.
+ */
+EGLImageKHR shm_import_image(compositor *compositor, compositor_buffer *buffer,
+			     struct wl_shm_buffer *shm_buf)
+{
+	if (!s_enabled || buffer->import_failed)
+		return EGL_NO_IMAGE_KHR;
+	if (!buffer->import_checked)
+		shm_import_buffer_lookup(buffer);
+
+	shm_import_pool *pool = buffer->import_pool;
+	uint32_t format = wl_shm_buffer_get_format(shm_buf);
+	int32_t width = wl_shm_buffer_get_width(shm_buf);
+	int32_t height = wl_shm_buffer_get_height(shm_buf);
+	int32_t stride = wl_shm_buffer_get_stride(shm_buf);
+	int i, n = sizeof(s_import_formats) / sizeof(s_import_formats[0]);
+
+	for (i = 0; i < n; i++) {
+		if (s_import_formats[i].shm_format == format)
+			break;
+	}
+	if (pool == NULL || i == n || !shm_import_pool_dmabuf(pool) ||
+	    (int64_t)buffer->import_offset + (int64_t)stride * height >
+		    pool->dmabuf_size) {
+		buffer->import_failed = true;
+		return EGL_NO_IMAGE_KHR;
+	}
+
+	EGLint attribs[] = {
+		EGL_WIDTH, width,
+		EGL_HEIGHT, height,
+		EGL_LINUX_DRM_FOURCC_EXT, s_import_formats[i].fourcc,
+		EGL_DMA_BUF_PLANE0_FD_EXT, pool->dmabuf_fd,
+		EGL_DMA_BUF_PLANE0_OFFSET_EXT, buffer->import_offset,
+		EGL_DMA_BUF_PLANE0_PITCH_EXT, stride,
+		EGL_NONE,
+	};
+	EGLImageKHR image = eglCreateImageKHR(compositor->egl_display,
+					      EGL_NO_CONTEXT,
+					      EGL_LINUX_DMA_BUF_EXT, NULL,
+					      attribs);
+	if (image == EGL_NO_IMAGE_KHR) {
+		DLOG("%s eglCreateImageKHR: 0x%x\n", __FUNCTION__,
+		     eglGetError());
+		buffer->import_failed = true;
+	}
+	return image;
+}
+
+/*
+ * Whether all planes of the buffer lie within its pool. Pools only grow,
+ * the size recorded when the buffer is attached is a lower bound.
+ */
+bool shm_import_buffer_fits(compositor_buffer *buffer,
+			    struct wl_shm_buffer *shm_buf)
+{
+	int32_t stride = wl_shm_buffer_get_stride(shm_buf);
+	int32_t height = wl_shm_buffer_get_height(shm_buf);
+	size_t size = render_shm_buffer_size(wl_shm_buffer_get_format(shm_buf),
+					     stride, height);
+
+	/* the first plane has been checked by libwayland */
+	if (size <= (size_t)stride * height)
+		return true;
+	if (!buffer->import_checked)
+		shm_import_buffer_lookup(buffer);
+
+	shm_import_pool *pool = buffer->import_pool;
+	if (pool && (int64_t)buffer->import_offset + (int64_t)size <=
+			    (int64_t)pool->size)
+		return true;
+	if (!buffer->layout_rejected) {
+		WLOG("%s: planes exceed the shm pool\n", __FUNCTION__);
+		buffer->layout_rejected = true;
+	}
+	return false;
+}
+
+void shm_import_buffer_release(compositor_buffer *buffer)
+{
+	if (buffer->import_pool) {
+		shm_import_pool_unref(buffer->import_pool);
+		buffer->import_pool = NULL;
+	}
+}
+
+int shm_import_init(compositor *compositor, struct wl_display *display,
+		    bool enable)
+{
+	wl_list_init(&s_pool_list);
+	wl_list_init(&s_pending_list);
+	s_logger = wl_display_add_protocol_logger(display, shm_import_log,
+						  NULL);
+	if (s_logger == NULL) {
+		ELOG("%s\n", __FUNCTION__);
+		return -1;
+	}
+	if (!enable) {
+		ILOG("shm zero-copy import: disabled\n");
+		return 0;
+	}
+
+	const char *extensions =
+		eglQueryString(compositor->egl_display, EGL_EXTENSIONS);
+	if (extensions == NULL ||
+	    strstr(extensions, "EGL_EXT_image_dma_buf_import") == NULL) {
+		ILOG("shm zero-copy import: no EGL_EXT_image_dma_buf_import\n");
+		return 0;
+	}
+	s_udmabuf_fd = open("/dev/udmabuf", O_RDWR | O_CLOEXEC);
+	if (s_udmabuf_fd < 0) {
+		ILOG("shm zero-copy import: /dev/udmabuf: %m\n");
+		return 0;
+	}
+
+	EGL_GET_PROC_ADDR(eglCreateImageKHR);
+	if (eglCreateImageKHR == NULL) {
+		ELOG("%s\n", __FUNCTION__);
+		close(s_udmabuf_fd);
+		s_udmabuf_fd = -1;
+		return -1;
+	}
+	s_page_size = sysconf(_SC_PAGESIZE);
+	s_enabled = true;
+	ILOG("shm zero-copy import: enabled\n");
+	return 0;
+}
@@ -0,0 +1,279 @@
+// SPDX-License-Identifier: Apache-2.0
+/**
+ * Copyright (c) 2024  Panasonic Automotive Systems, Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Change detection for shm clients that damage more than they redraw.
+ * The buffer is split into TILE_SIZE square tiles and a 64-bit hash is
+ * kept per tile of the content uploaded last. Damaged tiles are hashed
+ * again and only those whose hash changed are uploaded.
+ *
+ * The hash follows the XXH3 long-input loop: eight 64-bit lanes, each
+ * stripe adding data * (data ^ secret) folded to 32x32 bits, which maps
+ * onto _mm_mul_epu32. The secret depends on the stripe position within
+ * the row and the lanes are scrambled after every row, so moved content
+ * changes the hash.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wayland-server.h>
+#include "util_egl.h"
+#include "util_log.h"
+#include "compositor.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define TILE_SIZE 64
+#define STRIPE_LEN 64
+#define STRIPE_MAX 4 /* a tile row of 4 bytes per pixel */
+#define LANE_NUM 8
+
+#define PRIME32_1 0x9e3779b1U
+#define PRIME64_1 0x9e3779b185ebca87ULL
+#define PRIME64_2 0xc2b2ae3d27d4eb4fULL
+#define PRIME64_3 0x165667b19e3779f9ULL
+
+static uint64_t s_secret[STRIPE_MAX * LANE_NUM] __attribute__((aligned(16)));
+
+static uint64_t rotl64(uint64_t v, int r)
+{
+	return (v << r) | (v >> (64 - r));
+}
+
+void tile_hash_init(void)
+{
+	uint64_t x = PRIME64_3;
+
+	/* splitmix64 */
+	for (int i = 0; i < STRIPE_MAX * LANE_NUM; i++) {
+		uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		s_secret[i] = z ^ (z >> 31);
+	}
+}
+
+#ifdef __SSE2__
+static void hash_stripe(uint64_t *acc, const uint8_t *src,
+			const uint64_t *secret)
+{
+	for (int i = 0; i < LANE_NUM / 2; i++) {
+		__m128i a = _mm_load_si128((const __m128i *)acc + i);
+		__m128i d = _mm_loadu_si128((const __m128i *)src + i);
+		__m128i k = _mm_load_si128((const __m128i *)secret + i);
+		__m128i dk = _mm_xor_si128(d, k);
+		__m128i prod = _mm_mul_epu32(
+			dk, _mm_shuffle_epi32(dk, _MM_SHUFFLE(0, 3, 0, 1)));
+		__m128i swap = _mm_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2));
+
+		a = _mm_add_epi64(a, _mm_add_epi64(prod, swap));
+		_mm_store_si128((__m128i *)acc + i, a);
+	}
+}
+#else
+static void hash_stripe(uint64_t *acc, const uint8_t *src,
+			const uint64_t *secret)
+{
+	for (int i = 0; i < LANE_NUM; i++) {
+		uint64_t d;
+
+		memcpy(&d, src + i * 8, sizeof(d));
+		uint64_t dk = d ^ secret[i];
+		acc[i ^ 1] += d;
+		acc[i] += (dk & 0xffffffff) * (dk >> 32);
+	}
+}
+#endif
+
+static void hash_scramble(uint64_t *acc)
+{
+	for (int i = 0; i < LANE_NUM; i++) {
+		uint64_t a = acc[i];
+
+		a ^= a >> 47;
+		a ^= s_secret[i];
+		acc[i] = a * PRIME32_1;
+	}
+}
+
+/* row_bytes is at most STRIPE_MAX stripes */
+static uint64_t tile_hash(const uint8_t *src, int32_t stride,
+			  int32_t row_bytes, int32_t rows)
+{
+	uint64_t acc[LANE_NUM] __attribute__((aligned(16))) = {
+		PRIME32_1, PRIME64_1, PRIME64_2, PRIME64_3,
+		PRIME64_3, PRIME64_2, PRIME64_1, PRIME32_1,
+	};
+	int32_t full = row_bytes / STRIPE_LEN;
+	int32_t tail = row_bytes % STRIPE_LEN;
+	uint8_t last[STRIPE_LEN];
+
+	for (int32_t y = 0; y < rows; y++, src += stride) {
+		int32_t s;
+
+		for (s = 0; s < full; s++)
+			hash_stripe(acc, src + s * STRIPE_LEN,
+				    &s_secret[s * LANE_NUM]);
+		if (tail) {
+			memcpy(last, src + s * STRIPE_LEN, tail);
+			memset(last + tail, 0, STRIPE_LEN - tail);
+			hash_stripe(acc, last, &s_secret[s * LANE_NUM]);
+		}
+		hash_scramble(acc);
+	}
+
+	uint64_t h = (uint64_t)row_bytes * rows * PRIME64_1;
+	for (int i = 0; i < LANE_NUM; i++)
+		h = rotl64(h ^ (acc[i] * PRIME64_2), 31) * PRIME64_1;
+	h ^= h >> 33;
+	h *= PRIME64_2;
+	h ^= h >> 29;
+	h *= PRIME64_3;
+	h ^= h >> 32;
+	return h;
+}
+
+void tile_grid_reset(tile_grid *grid)
+{
+	grid->width = 0;
+	grid->height = 0;
+}
+
+void tile_grid_release(tile_grid *grid)
+{
+	free(grid->hash);
+	grid->hash = NULL;
+	grid->cols = 0;
+	grid->rows = 0;
+	tile_grid_reset(grid);
+}
+
+/* hash every tile, the grid did not describe the buffer before */
+static bool tile_grid_fill(tile_grid *grid, const uint8_t *data,
+			   int32_t stride, int32_t bpp, uint32_t format,
+			   int32_t width, int32_t height)
+{
+	int32_t cols = (width + TILE_SIZE - 1) / TILE_SIZE;
+	int32_t rows = (height + TILE_SIZE - 1) / TILE_SIZE;
+
+	if (cols * rows > grid->cols * grid->rows) {
+		uint64_t *hash = realloc(grid->hash,
+					 sizeof(*hash) * cols * rows);
+		if (hash == NULL) {
+			ELOG("%s\n", __FUNCTION__);
+			return false;
+		}
+		grid->hash = hash;
+	}
+	grid->cols = cols;
+	grid->rows = rows;
+	grid->width = width;
+	grid->height = height;
+	grid->format = format;
+
+	for (int32_t ty = 0; ty < rows; ty++) {
+		int32_t y = ty * TILE_SIZE;
+		int32_t h = height - y < TILE_SIZE ? height - y : TILE_SIZE;
+
+		for (int32_t tx = 0; tx < cols; tx++) {
+			int32_t x = tx * TILE_SIZE;
+			int32_t w = width - x < TILE_SIZE ? width - x :
+							    TILE_SIZE;
+
+			grid->hash[ty * cols + tx] = tile_hash(
+				data + (size_t)y * stride + (size_t)x * bpp,
+				stride, w * bpp, h);
+		}
+	}
+	return true;
+}
+
+/*
+ * Shrink dmg to the damaged tiles whose content differs from the last
+ * call. Returns false when no tile changed and nothing needs uploading.
+ * A grid describing another buffer size or format is refilled and the
+ * damage kept as is. bpp is at most 4.
+ */
+bool tile_grid_refine(tile_grid *grid, const uint8_t *data, int32_t stride,
+		      int32_t bpp, uint32_t format, int32_t width,
+		      int32_t height, damage *dmg)
+{
+	if (grid->width != width || grid->height != height ||
+	    grid->format != format) {
+		if (!tile_grid_fill(grid, data, stride, bpp, format, width,
+				    height))
+			tile_grid_reset(grid);
+		return true;
+	}
+
+	damage_rect all = { 0, 0, width, height };
+	const damage_rect *rects = dmg->full ? &all : dmg->rects;
+	int num = dmg->full ? 1 : dmg->num;
+	damage changed;
+	int changed_tiles = 0;
+
+	damage_init(&changed);
+	for (int32_t ty = 0; ty < grid->rows; ty++) {
+		int32_t y = ty * TILE_SIZE;
+		int32_t h = height - y < TILE_SIZE ? height - y : TILE_SIZE;
+		int32_t run = -1; /* first changed tile of the current run */
+
+		for (int32_t tx = 0; tx <= grid->cols; tx++) {
+			int32_t x = tx * TILE_SIZE;
+			int32_t w = width - x < TILE_SIZE ? width - x :
+							    TILE_SIZE;
+			bool dirty = false;
+
+			for (int i = 0; tx < grid->cols && i < num; i++) {
+				const damage_rect *r = &rects[i];
+
+				if (r->x < x + w && x < r->x + r->w &&
+				    r->y < y + h && y < r->y + r->h) {
+					dirty = true;
+					break;
+				}
+			}
+			if (dirty) {
+				uint64_t hash = tile_hash(
+					data + (size_t)y * stride +
+						(size_t)x * bpp,
+					stride, w * bpp, h);
+				uint64_t *old = &grid->hash[ty * grid->cols + tx];
+
+				dirty = hash != *old;
+				*old = hash;
+			}
+			if (dirty) {
+				changed_tiles++;
+				if (run < 0)
+					run = tx;
+			} else if (run >= 0) {
+				damage_add(&changed, run * TILE_SIZE, y,
+					   x - run * TILE_SIZE, h);
+				run = -1;
+			}
+		}
+	}
+	damage_clip(&changed, width, height);
+
+	*dmg = changed;
+	return changed_tiles > 0;
+}
@@ -0,0 +1,168 @@
+// SPDX-License-Identifier: Apache-2.0
+/**
+ * Copyright (c) 2024  Panasonic Automotive Systems, Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Fixed-size ring of per-frame records. A record is opened when a buffer
+ * is committed and stamped as the frame moves through the render thread.
+ * Writers never block: a record overwritten by a newer frame is detected
+ * by its id and further stamps for the old frame are dropped.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <wayland-server.h>
+#include "util_egl.h"
+#include "util_log.h"
+#include "compositor.h"
+
+#define TIMELINE_SIZE 1024 /* power of two */
+#define TIMELINE_FRAME_MAX 64
+
+typedef struct timeline_record {
+	_Atomic uint32_t id; /* 0: never used */
+	_Atomic uint32_t surface_id;
+	_Atomic uint32_t client_pid;
+	_Atomic uint64_t stamp_nsec[TIMELINE_STAGE_NUM];
+} timeline_record;
+
+static timeline_record s_ring[TIMELINE_SIZE];
+static _Atomic uint32_t s_next_id = 0;
+
+/* records composited into the frame being presented, render thread only */
+static uint32_t s_frame_ids[TIMELINE_FRAME_MAX];
+static int s_frame_num = 0;
+
+static const char *s_stage_name[TIMELINE_STAGE_NUM] = {
+	"commit", "copy", "upload", "fence", "draw", "swap", "flip",
+};
+
+uint32_t timeline_begin(uint32_t surface_id, uint32_t client_pid)
+{
+	uint32_t id = atomic_fetch_add(&s_next_id, 1) + 1;
+	if (id == 0)
+		id = atomic_fetch_add(&s_next_id, 1) + 1;
+	timeline_record *rec = &s_ring[id & (TIMELINE_SIZE - 1)];
+
+	atomic_store_explicit(&rec->id, 0, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	for (int i = 0; i < TIMELINE_STAGE_NUM; i++)
+		atomic_store_explicit(&rec->stamp_nsec[i], 0,
+				      memory_order_relaxed);
+	atomic_store_explicit(&rec->surface_id, surface_id,
+			      memory_order_relaxed);
+	atomic_store_explicit(&rec->client_pid, client_pid,
+			      memory_order_relaxed);
+	atomic_store_explicit(&rec->stamp_nsec[TIMELINE_COMMIT],
+			      get_monotonic_nsec(), memory_order_relaxed);
+	atomic_store_explicit(&rec->id, id, memory_order_release);
+	return id;
+}
+
+/* only the first stamp of a stage is kept */
+static bool timeline_stamp_at(uint32_t id, timeline_stage stage,
+			      uint64_t nsec)
+{
+	if (id == 0)
+		return false;
+
+	timeline_record *rec = &s_ring[id & (TIMELINE_SIZE - 1)];
+	if (atomic_load_explicit(&rec->id, memory_order_acquire) != id)
+		return false;
+
+	uint64_t unset = 0;
+	return atomic_compare_exchange_strong_explicit(
+		&rec->stamp_nsec[stage], &unset, nsec, memory_order_relaxed,
+		memory_order_relaxed);
+}
+
+void timeline_stamp(uint32_t id, timeline_stage stage)
+{
+	timeline_stamp_at(id, stage, get_monotonic_nsec());
+}
+
+/* a displayed commit joins the frame the first time it is drawn */
+void timeline_frame_add(uint32_t id)
+{
+	if (id == 0 || s_frame_num >= TIMELINE_FRAME_MAX)
+		return;
+
+	timeline_record *rec = &s_ring[id & (TIMELINE_SIZE - 1)];
+	if (atomic_load_explicit(&rec->id, memory_order_acquire) != id ||
+	    atomic_load_explicit(&rec->stamp_nsec[TIMELINE_DRAW],
+				 memory_order_relaxed) != 0)
+		return;
+	s_frame_ids[s_frame_num++] = id;
+}
+
+void timeline_frame_stamp(timeline_stage stage)
+{
+	uint64_t nsec = get_monotonic_nsec();
+
+	for (int i = 0; i < s_frame_num; i++)
+		timeline_stamp_at(s_frame_ids[i], stage, nsec);
+	if (stage == TIMELINE_FLIP)
+		s_frame_num = 0;
+}
+
+void timeline_frame_begin(void)
+{
+	s_frame_num = 0;
+}
+
+/*
+ * Print the ring, oldest first, with every stage relative to the commit.
+ * Records being rewritten while dumping are skipped.
+ */
+void timeline_dump(void)
+{
+	uint32_t last = atomic_load(&s_next_id);
+	uint32_t first = last > TIMELINE_SIZE ? last - TIMELINE_SIZE + 1 : 1;
+
+	ILOG("timeline: %u frames (usec from commit)\n", last - first + 1);
+	ILOG("%10s %8s %8s", "id", "surface", "pid");
+	for (int i = 1; i < TIMELINE_STAGE_NUM; i++)
+		LOG(" %8s", s_stage_name[i]);
+	LOG("\n");
+
+	for (uint32_t id = first; id != last + 1; id++) {
+		timeline_record *rec = &s_ring[id & (TIMELINE_SIZE - 1)];
+		uint64_t stamp[TIMELINE_STAGE_NUM];
+
+		if (atomic_load_explicit(&rec->id, memory_order_acquire) != id)
+			continue;
+		uint32_t surface_id = atomic_load(&rec->surface_id);
+		uint32_t client_pid = atomic_load(&rec->client_pid);
+		for (int i = 0; i < TIMELINE_STAGE_NUM; i++)
+			stamp[i] = atomic_load(&rec->stamp_nsec[i]);
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&rec->id, memory_order_relaxed) != id)
+			continue;
+
+		ILOG("%10u %8u %8u", id, surface_id, client_pid);
+		for (int i = 1; i < TIMELINE_STAGE_NUM; i++) {
+			if (stamp[i] == 0 || stamp[i] < stamp[TIMELINE_COMMIT])
+				LOG(" %8s", "-");
+			else
+				LOG(" %8llu",
+				    (unsigned long long)(stamp[i] -
+							 stamp[TIMELINE_COMMIT]) /
+					    1000);
+		}
+		LOG("\n");
+	}
+}